@@ -0,0 +1,163 @@
+/*
+ * boot_time - Measure the startup (.data copy and .bss clear).
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * early_init() sets the system clock to 24 MHz and starts SysTick, so
+ * SysTick counts the cycles of the word-wide copy and clear in _reset().
+ * main() prints them (USART0, 115200 baud) together with the cycles of
+ * the old byte-wide loops over the same sections.
+ *
+ * PIO0_2 goes high at the top of main(); the time from the rising edge
+ * of RESET to it is the whole boot time.
+ */
+
+#include <syscon.h>
+#include <flashcon.h>
+#include <gpio.h>
+#include <usart.h>
+#include <systick.h>
+#include <nvic.h>
+
+/* USART clock frequency */
+#define U_PCLK	(16 * 115200)
+
+#define NO_MEMCPY	__attribute__ ((optimize \
+					("no-tree-loop-distribute-patterns")))
+
+extern unsigned int _data_start[];
+extern unsigned int _data_end[];
+extern unsigned int _data_load_start[];
+extern unsigned int _bss_start[];
+extern unsigned int _bss_end[];
+
+/* Sections of a typical size */
+int table[64] = {1};
+int buf[128];
+
+/* No variables here (.data and .bss are not ready yet). */
+void early_init(void)
+{
+	/* 2 system clocks flash access time for 24 MHz */
+	flashcon_set_flash_access_time(2);
+
+	/* Set up PLL (Fclkin = 12MHz (IRC), Fclkout (Main clock) = 24MHz) */
+	syscon_enable_pll(SYSCON_IRC, 2, 4);
+	syscon_set_system_clock(SYSCON_PLL_OUT, 1);
+
+	/* Free running down counter (system clock) */
+	systick_enable_timer(0xffffff, SYST_SYSCLK);
+}
+
+static int elapsed(int start)
+{
+	return (start - systick_get_timer()) & 0xffffff;
+}
+
+/* The startup loops before the linker scripts were word aligned */
+static NO_MEMCPY int byte_copy_clear(void)
+{
+	char *src;
+	char *dst;
+	int start;
+
+	start = systick_get_timer();
+	src = (char *)_data_load_start;
+	for (dst = (char *)_data_start; dst < (char *)_data_end; dst++)
+		*dst = *src++;
+	for (dst = (char *)_bss_start; dst < (char *)_bss_end; dst++)
+		*dst = 0;
+	return elapsed(start);
+}
+
+static void gpio_setup(void)
+{
+	/* Enable IOCON clock. */
+	syscon_enable_clock(SYSCON_IOCON);
+
+	/* Prevent the I2C pins from internally floating. */
+	gpio_config(GPIO_OUTPUT, GPIO_IO, PIO0_10 | PIO0_11);
+	gpio_clear(PIO0_10 | PIO0_11);
+
+	/* Set PIO0_2 to 'output push-pull' (boot time mark). */
+	gpio_config(GPIO_OUTPUT, 0, PIO0_2);
+
+	/* Set PIO0_4 to U0_TXD. */
+	gpio_config(GPIO_U0_TXD, GPIO_HYST, PIO0_4);
+}
+
+static void usart_setup(void)
+{
+	syscon_set_usart_clock(24000000, U_PCLK);
+	syscon_enable_clock(SYSCON_UART0);
+	usart_init(USART0, U_PCLK, 115200, 8, 1, USART_PARITY_NONE,
+		   USART_FLOW_NONE);
+}
+
+static void xputs(const char *s)
+{
+	while (*s)
+		usart_send_blocking(USART0, *s++);
+}
+
+static void print_dec(int n)
+{
+	char s[12];
+	int i;
+
+	i = sizeof(s) - 1;
+	s[i] = '\0';
+	do {
+		s[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	xputs(&s[i]);
+}
+
+int main(void)
+{
+	int word;
+	int byte;
+
+	/* Cycles since early_init() (_reset() word loops) */
+	word = elapsed(0xffffff);
+
+	gpio_setup();
+	gpio_set(PIO0_2);
+
+	/* .data is still unmodified; copying it again is harmless. */
+	byte = byte_copy_clear();
+
+	usart_setup();
+
+	xputs("data ");
+	print_dec((_data_end - _data_start) * 4);
+	xputs(" bytes, bss ");
+	print_dec((_bss_end - _bss_start) * 4);
+	xputs(" bytes\r\nword copy/clear ");
+	print_dec(word);
+	xputs(" cycles, byte copy/clear ");
+	print_dec(byte);
+	xputs(" cycles (24 MHz)\r\n");
+
+	buf[0] = table[0];
+	while (1)
+		;
+
+	return 0;
+}
@@ -30,7 +30,7 @@ u16 crc16(u16 crc, u8 const *buffer, size_t len);
 u32 crc32_le(u32 crc, unsigned char const *p, size_t len);
 u32 crc32_be(u32 crc, unsigned char const *p, size_t len);
 
-int main()
+int main(int argc, char *argv[])
 {
 	int i;
 	struct timeval tv;
@@ -43,14 +43,17 @@ int main()
 		unsigned int result;	/* expected crc result */
 	} result[TESTLEN];
 
-	/* Random data */
-	if (gettimeofday(&tv, NULL)) {
-		perror("gettimeofday failed");
-		return 1;
+	/* Random data (the same with a seed argument) */
+	if (argc > 1) {
+		srandom(strtoul(argv[1], NULL, 0));
+	} else {
+		if (gettimeofday(&tv, NULL)) {
+			perror("gettimeofday failed");
+			return 1;
+		}
+		srandom(tv.tv_usec);
 	}
 
-	srandom(tv.tv_usec);
-
 	for (i = 0; i < DATALEN; i++)
 		buf[i] = random();
 
@@ -253,7 +253,8 @@ static void delay_ms(int ms)
 	mrt_clear_channel_status(MRT0, MRT_INT);
 }
 
-void spi0_isr(void)
+/* Runs from SRAM, free of flash wait states (see RAMFUNC in mmio.h) */
+RAMFUNC void spi0_isr(void)
 {
 	int m;
 	int s;
@@ -25,8 +25,14 @@
 /* USART clock frequency */
 #define U_PCLK	(16 * 115200)
 
-/* Queue size */
-#define QUEUESIZE	8
+/* Buffer size (power of 2) */
+#define BUFSIZE		32
+
+_Static_assert(USART_RING_SIZE_OK(BUFSIZE), "BUFSIZE must be a power of 2");
+
+static u8 rxbuf[BUFSIZE];
+static u8 txbuf[BUFSIZE];
+static struct usart_buffered uart0;
 
 /* Set LPC810 to 30 MHz. */
 static void clock_setup(void)
@@ -81,12 +87,12 @@ static void usart_setup(void)
 	/* Enable USART0 clock. */
 	syscon_enable_clock(SYSCON_UART0);
 
+	/* Set up buffered I/O (enables USART0 Receive interrupt). */
+	usart_buffered_init(&uart0, USART0, rxbuf, BUFSIZE, txbuf, BUFSIZE);
+
 	/* Enable USART0 interrupt. */
 	nvic_enable_irq(NVIC_UART0);
 
-	/* Enable USART0 Receive interrupt. */
-	usart_enable_interrupt(USART0, USART_RXRDY);
-
 	/* Set up USART0. */
 	usart_init(USART0, U_PCLK, 115200, 8, 1, USART_PARITY_NONE,
 		   USART_FLOW_NONE);
@@ -94,69 +100,44 @@ static void usart_setup(void)
 
 void uart0_isr(void)
 {
-	int m;
-	int s;
-
-	/* Rx, Tx queue */
-	static int queue[QUEUESIZE];
-	static int head;	/* read pointer */
-	static int tail;	/* write pointer */
-	static int qlen;
-
-	/* Get interrupt mask. */
-	m = usart_get_interrupt_mask(USART0, USART_RXRDY | USART_TXRDY);
-
-	/* Get interrupt status. */
-	s = usart_get_interrupt_status(USART0, USART_RXRDY | USART_TXRDY);
-
-	/* RxRDY */
-	if (m & s & USART_RXRDY) {
-		if (qlen < QUEUESIZE) {
-			/* LED1 on/off */
-			gpio_toggle(PIO0_2);
-
-			/* Receive data. */
-			queue[tail++] = usart_recv(USART0);
-			tail %= QUEUESIZE;
-			qlen++;
-
-			/* Enable transmit interrupt. */
-			if (!(m & USART_TXRDY))
-				usart_enable_interrupt(USART0, USART_TXRDY);
-		} else {
-			/* Overflow */
-			/* Clear interrupt. */
-			usart_recv(USART0);
-		}
-
-	}
-
-	/* TxRDY */
-	if (m & s & USART_TXRDY) {
-		if (qlen) {
-			/* LED2 on/off */
-			gpio_toggle(PIO0_3);
-
-			/* Send data. */
-			usart_send(USART0, queue[head++]);
-			head %= QUEUESIZE;
-			qlen--;
-		} else {
-			/* No more data */
-			/* Disable transmit interrupt. */
-			usart_disable_interrupt(USART0, USART_TXRDY);
-		}
-	}
+	usart_buffered_isr(&uart0);
 }
 
 int main(void)
 {
+	u8 buf[BUFSIZE];
+	int n;
+	int i;
+
 	clock_setup();
 	gpio_setup();
 	usart_setup();
 
-	while (1)
-		;
+	while (1) {
+		/* Receive data. */
+		n = usart_read(&uart0, buf, sizeof(buf));
+		if (n == 0) {
+			/*
+			 * Sleep until the next interrupt.  WFI wakes up on a
+			 * pending interrupt even if interrupts are disabled.
+			 */
+			__asm__ ("cpsid i");
+			if (uart0.rx.head == uart0.rx.tail)
+				__asm__ ("wfi");
+			__asm__ ("cpsie i");
+			continue;
+		}
+
+		/* LED1 on/off */
+		gpio_toggle(PIO0_2);
+
+		/* Send data (wait for room in the Tx buffer). */
+		for (i = 0; i < n; i += usart_write(&uart0, &buf[i], n - i))
+			;
+
+		/* LED2 on/off */
+		gpio_toggle(PIO0_3);
+	}
 
 	return 0;
 }
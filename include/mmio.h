@@ -30,9 +30,49 @@ typedef uint8_t		u8;
 typedef uint16_t	u16;
 typedef uint32_t	u32;
 
+/*
+ * Function run from SRAM (no flash wait states), e.g. an ISR.  _reset()
+ * copies the .ramfunc section.  Flash and SRAM are out of the BL range
+ * of each other: RAMFUNC functions are called through a register, and
+ * calls from them to flash go through linker veneers (-DLPC81X_INLINE
+ * keeps the usart, spi and gpio calls in SRAM).
+ */
+#ifdef MMIO_HOST
+#define RAMFUNC
+#else
+#define RAMFUNC		__attribute__ ((section (".ramfunc"), long_call, \
+					noinline))
+#endif
+
+#ifdef MMIO_HOST
+/*
+ * Host build: registers are held by a model (lib/nxp_lpc/lpc81x/mmio_host.c,
+ * <mmio_host.h>).  An access is applied to the model at the next access
+ * or at mmio_host_sync().
+ */
+volatile void *mmio_host_map(u32 addr, int size);
+
+#ifdef MMIO_COUNT
+/* Accounting build: every access is counted per call site (<mmio_count.h>). */
+volatile void *mmio_count_map(u32 addr, int size, const char *file, int line,
+			      const char *func);
+
+#define MMIO8(addr)	(*(volatile u8 *)mmio_count_map((addr), 1, \
+					__FILE__, __LINE__, __func__))
+#define MMIO16(addr)	(*(volatile u16 *)mmio_count_map((addr), 2, \
+					 __FILE__, __LINE__, __func__))
+#define MMIO32(addr)	(*(volatile u32 *)mmio_count_map((addr), 4, \
+					 __FILE__, __LINE__, __func__))
+#else
+#define MMIO8(addr)	(*(volatile u8 *)mmio_host_map((addr), 1))
+#define MMIO16(addr)	(*(volatile u16 *)mmio_host_map((addr), 2))
+#define MMIO32(addr)	(*(volatile u32 *)mmio_host_map((addr), 4))
+#endif
+#else
 /* Memory mapped I/O */
 #define MMIO8(addr)	(*(volatile u8 *)(addr))
 #define MMIO16(addr)	(*(volatile u16 *)(addr))
 #define MMIO32(addr)	(*(volatile u32 *)(addr))
+#endif
 
 #endif
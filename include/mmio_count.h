@@ -0,0 +1,51 @@
+/*
+ * Register access accounting
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Used by programs linked with liblpc81x-count.a ("make count").
+ *
+ * The library is the host build (<mmio_host.h>) compiled with -O0, so
+ * that a read-modify-write is a load and a store as on the Cortex-M0+.
+ * Each register load and store is counted for the MMIOx() call site and
+ * for the outermost library function that was called (found with
+ * -finstrument-functions; link the program with -rdynamic).
+ */
+
+#ifndef MMIO_COUNT_H
+#define MMIO_COUNT_H
+
+#include <mmio_host.h>
+
+struct mmio_count {
+	const char *function;
+	const char *file;	/* call site only */
+	int line;		/* call site only */
+	unsigned long calls;	/* function only */
+	unsigned long loads;
+	unsigned long stores;
+};
+
+void mmio_count_reset(void);
+int mmio_count_functions(const struct mmio_count **table);
+int mmio_count_sites(const struct mmio_count **table);
+
+/* Called by mmio_host.c when an access is completed */
+void mmio_count_access(bool load, bool store);
+
+#endif
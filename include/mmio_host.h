@@ -0,0 +1,56 @@
+/*
+ * Host register model
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Used by programs linked with liblpc81x-host.a ("make host").
+ *
+ * Every register reads as written (0 after reset) unless a hook is
+ * installed for it.  A read hook returns the value the driver sees; a
+ * write hook gets every value the driver stores, also one equal to the
+ * value it read.
+ *
+ * mmio_host_reset() installs models of the SYSCON PLL lock, the GPIO
+ * port, USART0/1/2, SPI0/1 and the CRC engine.  Interrupts are not
+ * generated; a test calls the handler itself.
+ */
+
+#ifndef MMIO_HOST_H
+#define MMIO_HOST_H
+
+#include <mmio.h>
+
+typedef u32 (*mmio_host_read_t)(void *ctx, u32 addr, u32 value);
+typedef void (*mmio_host_write_t)(void *ctx, u32 addr, u32 value);
+
+void mmio_host_reset(void);
+void mmio_host_sync(void);
+u32 mmio_host_peek(u32 addr);
+void mmio_host_poke(u32 addr, u32 value);
+int mmio_host_add_hook(u32 addr, u32 size, mmio_host_read_t read,
+		       mmio_host_write_t write, void *ctx);
+
+/* USART: data received by the device, data sent by the device */
+int mmio_host_usart_input(int usart, const u8 *data, int size);
+int mmio_host_usart_output(int usart, u8 *data, int size);
+
+/* SPI: frames received (MISO) and sent (MOSI) by the device */
+int mmio_host_spi_input(int spi, const u16 *data, int size);
+int mmio_host_spi_output(int spi, u16 *data, int size);
+
+#endif
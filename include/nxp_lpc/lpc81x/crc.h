@@ -84,7 +84,21 @@ enum {
 	CRC_CMPL_SUM = (1 << 5)
 };
 
+/*
+ * Streaming context.  The engine keeps the state of the context that was
+ * updated last; it is saved only when another context or crc_calc*()
+ * takes the engine over.  crc_calc*() keep using the mode set by
+ * crc_set_mode().  Not to be shared between an ISR and main().
+ */
+struct crc_context {
+	int mode;
+	int seed;		/* CRC_SEED form of the state */
+};
+
 void crc_set_mode(int mode);
 int crc_calc(int crc, char *buffer, int len);
 int crc_calc16(int crc, short *buffer, int len);
 int crc_calc32(int crc, int *buffer, int len);
+void crc_init(struct crc_context *ctx, int mode, int seed);
+void crc_update(struct crc_context *ctx, const void *buffer, int len);
+int crc_final(struct crc_context *ctx);
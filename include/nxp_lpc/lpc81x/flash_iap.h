@@ -68,5 +68,29 @@
 #define IAP_SECTOR_NOT_PREPARED_FOR_WRITE_OP	9
 #define IAP_COMPARE_ERROR			10
 #define IAP_BUSY				11
+#define IAP_PARAM_ERROR				12	/* clock unknown */
 
 typedef void (*IAP)(unsigned int cmd[], unsigned int resp[]);
+
+/* --- Function prototypes ------------------------------------------------- */
+
+/*
+ * The functions below call the IAP with interrupts disabled (the flash
+ * is not readable while it runs) and the system clock frequency taken
+ * from syscon_get_system_clock().  They return an IAP status code.
+ * If the clock comes from the crystal or CLKIN, its frequency must be set
+ * with syscon_set_external_clock() first; the functions that erase or
+ * program return IAP_PARAM_ERROR otherwise.
+ * The IAP uses the top 32 bytes of RAM; the default linker scripts start
+ * the stack below them.
+ */
+
+#define IAP_SECTOR_SIZE				1024
+#define IAP_PAGE_SIZE				64
+
+int iap_prepare(int start, int end);
+int iap_erase_sectors(int start, int end);
+int iap_erase_pages(int start, int end);
+int iap_program(u32 dst, const void *src, int len);
+int iap_compare(u32 dst, const void *src, int len);
+int iap_read_uid(u32 uid[4]);
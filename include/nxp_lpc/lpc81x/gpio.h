@@ -294,6 +294,16 @@ enum  gpio_func {
 
 void gpio_config(enum gpio_func func, int iocon, int pins);
 void gpio_reconfig(enum gpio_func func, int iocon, int pins);
+
+/*
+ * Port and pin functions
+ *
+ * Static inline with LPC81X_INLINE defined (see usart.h).
+ */
+#ifdef LPC81X_INLINE
+#define GPIO_INLINE	static inline
+#else
+#define GPIO_INLINE
 void gpio_set(int pins);
 void gpio_clear(int pins);
 int gpio_get(int pins);
@@ -307,3 +317,83 @@ int gpio_read_pin_byte(int pin);
 void gpio_write_pin_byte(int pin, int data);
 int gpio_read_pin_word(int pin);
 void gpio_write_pin_word(int pin, int data);
+#endif
+
+#if defined(LPC81X_INLINE) || defined(GPIO_C)
+GPIO_INLINE void gpio_set(int pins)
+{
+	GPIO_SET0 = pins & 0x3ffff;
+}
+
+GPIO_INLINE void gpio_clear(int pins)
+{
+	GPIO_CLR0 = pins & 0x3ffff;
+}
+
+GPIO_INLINE int gpio_get(int pins)
+{
+	return GPIO_PIN0 & pins;
+}
+
+GPIO_INLINE void gpio_toggle(int pins)
+{
+	GPIO_NOT0 = pins & 0x3ffff;
+}
+
+GPIO_INLINE int gpio_read_port(void)
+{
+	return GPIO_PIN0;
+}
+
+GPIO_INLINE void gpio_write_port(int data)
+{
+	GPIO_PIN0 = data & 0x3ffff;
+}
+
+GPIO_INLINE void gpio_set_mask(int mask)
+{
+	GPIO_MASK0 = mask & 0x3ffff;
+}
+
+GPIO_INLINE int gpio_read_masked_port(void)
+{
+	return GPIO_MPIN0;
+}
+
+GPIO_INLINE void gpio_write_maksed_port(int data)
+{
+	GPIO_MPIN0 = data & 0x3ffff;
+}
+
+GPIO_INLINE int gpio_read_pin_byte(int pin)
+{
+	if (pin < 0 || pin >= GPIO_MAXPIN)
+		return 0;
+
+	return GPIO_B(pin);
+}
+
+GPIO_INLINE void gpio_write_pin_byte(int pin, int data)
+{
+	if (pin < 0 || pin >= GPIO_MAXPIN)
+		return;
+
+	GPIO_B(pin) = data;
+}
+
+GPIO_INLINE int gpio_read_pin_word(int pin)
+{
+	if (pin < 0 || pin >= GPIO_MAXPIN)
+		return 0;
+
+	return GPIO_W(pin);
+}
+
+GPIO_INLINE void gpio_write_pin_word(int pin, int data)
+{
+	if (pin < 0 || pin >= GPIO_MAXPIN)
+		return;
+
+	GPIO_W(pin) = data;
+}
+#endif
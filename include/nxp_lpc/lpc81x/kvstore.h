@@ -0,0 +1,73 @@
+/*
+ * Wear-leveled key/value store in flash
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The store is a circular log of 64-byte flash pages (IAP_ERASE_PAGE)
+ * in a region of whole sectors.  Each record takes one page: a sequence
+ * number, the key, up to KV_VALUE_MAX bytes of value and a CRC-32
+ * calculated by the CRC engine.  A new value is appended at the tail;
+ * the oldest page (the head) is erased when fewer than two pages are
+ * free, after the record in it is moved to the tail if it is still the
+ * latest one of its key.  Every page is thus erased at the same rate,
+ * and an update costs one 64-byte program and at most one page erase
+ * instead of a 1 KB sector erase.
+ *
+ * kv_init() scans the region and builds the index of the latest record
+ * of each key in RAM (4 bytes per key).
+ *
+ * The flash is written with <flash_iap.h>.
+ */
+
+#include <flash_iap.h>
+
+#define KV_PAGE_SIZE		IAP_PAGE_SIZE
+#define KV_SECTOR_SIZE		IAP_SECTOR_SIZE
+#define KV_VALUE_MAX		52
+#define KV_MAX_KEYS		16
+
+/* Return values */
+enum {
+	KV_NOT_FOUND = -1,
+	KV_FULL = -2,		/* too many keys or no free page */
+	KV_INVALID = -3,
+	KV_IAP_ERROR = -4
+};
+
+struct kv_index {
+	u16 key;
+	u16 page;
+};
+
+struct kv_store {
+	u32 base;		/* first sector (1 KB aligned) */
+	int pages;
+	int head;		/* oldest page */
+	int tail;		/* next page to be programmed */
+	int used;		/* pages between the head and the tail */
+	u32 seq;		/* sequence number of the next record */
+	int nkeys;
+	struct kv_index index[KV_MAX_KEYS];
+};
+
+/* --- Function prototypes ------------------------------------------------- */
+
+int kv_init(struct kv_store *kv, u32 base, int sectors);
+int kv_get(struct kv_store *kv, int key, void *data, int size);
+int kv_set(struct kv_store *kv, int key, const void *data, int len);
+int kv_delete(struct kv_store *kv, int key);
@@ -238,6 +238,9 @@ void pinint5_isr(void)	__attribute__ ((weak));
 void pinint6_isr(void)	__attribute__ ((weak));
 void pinint7_isr(void)	__attribute__ ((weak));
 
+/* Called by _reset() before .data and .bss are set up (see vector.c) */
+void early_init(void)	__attribute__ ((weak));
+
 /* --- Function prototypes ------------------------------------------------- */
 
 /* Interrupts */
@@ -230,6 +230,16 @@ void spi_enable(spi_t spi);
 void spi_disable(spi_t spi);
 void spi_enable_loop_back(spi_t spi);
 void spi_disable_loop_back(spi_t spi);
+
+/*
+ * Data, status and interrupt functions
+ *
+ * Static inline with LPC81X_INLINE defined (see usart.h).
+ */
+#ifdef LPC81X_INLINE
+#define SPI_INLINE	static inline
+#else
+#define SPI_INLINE
 void spi_send(spi_t spi, int data);
 void spi_set_tx_control(spi_t spi, int len, int control);
 void spi_send_control(spi_t spi, int data, int len, int control);
@@ -243,3 +253,103 @@ int spi_get_interrupt_mask(spi_t spi, int interrupt);
 int spi_get_interrupt_status(spi_t spi, int interrupt);
 int spi_get_status(spi_t spi, int status);
 void spi_clear_status(spi_t spi, int status);
+#endif
+
+#if defined(LPC81X_INLINE) || defined(SPI_C)
+static inline int spi_base_addr(spi_t spi)
+{
+	switch (spi) {
+	case SPI0:
+		return SPI0_BASE;
+	case SPI1:
+		return SPI1_BASE;
+	default:
+		break;
+	}
+	return 0;
+}
+
+SPI_INLINE void spi_send(spi_t spi, int data)
+{
+	SPI_TXDAT(spi_base_addr(spi)) = data & 0xffff;
+}
+
+SPI_INLINE void spi_set_tx_control(spi_t spi, int len, int control)
+{
+	SPI_TXCTL(spi_base_addr(spi)) = (((len - 1) & 0xf) << 24) |
+		(control & 0x710000);
+}
+
+SPI_INLINE void spi_send_control(spi_t spi, int data, int len, int control)
+{
+	SPI_TXDATCTL(spi_base_addr(spi)) = (((len - 1) & 0xf) << 24) |
+		(control & 0x710000) | (data & 0xffff);
+}
+
+SPI_INLINE int spi_recv(spi_t spi)
+{
+	return SPI_RXDAT(spi_base_addr(spi)) & 0x11ffff;
+}
+
+SPI_INLINE void spi_send_blocking(spi_t spi, int data)
+{
+	int base;
+
+	base = spi_base_addr(spi);
+	while (!(SPI_STAT(base) & SPI_STAT_TXRDY))
+		;
+	SPI_TXDAT(base) = data & 0xffff;
+}
+
+SPI_INLINE void spi_send_control_blocking(spi_t spi, int data, int len,
+					  int control)
+{
+	int base;
+
+	base = spi_base_addr(spi);
+	while (!(SPI_STAT(base) & SPI_STAT_TXRDY))
+		;
+	SPI_TXDATCTL(base) = (((len - 1) & 0xf) << 24) |
+		(control & 0x710000) | (data & 0xffff);
+}
+
+SPI_INLINE int spi_recv_blocking(spi_t spi)
+{
+	int base;
+
+	base = spi_base_addr(spi);
+	while (!(SPI_STAT(base) & SPI_STAT_RXRDY))
+		;
+	return SPI_RXDAT(base) & 0x11ffff;
+}
+
+SPI_INLINE void spi_enable_interrupt(spi_t spi, int interrupt)
+{
+	SPI_INTENSET(spi_base_addr(spi)) = interrupt & 0x3f;
+}
+
+SPI_INLINE void spi_disable_interrupt(spi_t spi, int interrupt)
+{
+	SPI_INTENCLR(spi_base_addr(spi)) = interrupt & 0x3f;
+}
+
+SPI_INLINE int spi_get_interrupt_mask(spi_t spi, int interrupt)
+{
+	return SPI_INTENSET(spi_base_addr(spi)) & interrupt;
+}
+
+SPI_INLINE int spi_get_interrupt_status(spi_t spi, int interrupt)
+{
+	return SPI_INTSTAT(spi_base_addr(spi)) & interrupt;
+}
+
+SPI_INLINE int spi_get_status(spi_t spi, int status)
+{
+	return SPI_STAT(spi_base_addr(spi)) & status;
+}
+
+SPI_INLINE void spi_clear_status(spi_t spi, int status)
+{
+	SPI_STAT(spi_base_addr(spi)) = status & 0x1ff;
+}
+#endif
@@ -539,6 +539,8 @@ void syscon_disable_wdt_osc(void);
 int syscon_get_reset_status(int reset);
 void syscon_clear_reset_status(int reset);
 void syscon_set_system_clock(enum syscon_osc source, int div);
+void syscon_set_external_clock(int freq);
+int syscon_get_system_clock(void);
 void syscon_enable_clock(int peripheral);
 void syscon_disable_clock(int peripheral);
 void syscon_set_usart_clock(int main_clock, int u_pclk);
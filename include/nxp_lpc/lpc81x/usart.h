@@ -256,6 +256,25 @@ enum {
 	USART_RX_NOISE = (1 << 15)
 };
 
+/* Ring size check for a constant, e.g. in _Static_assert() */
+#define USART_RING_SIZE_OK(n)	((n) > 0 && ((n) & ((n) - 1)) == 0)
+
+/* Ring buffer (single producer, single consumer) */
+struct usart_ring {
+	u8 *buf;
+	unsigned int size;		/* power of 2 */
+	volatile unsigned int head;	/* read index */
+	volatile unsigned int tail;	/* write index */
+};
+
+/* Interrupt-driven buffered I/O (8-bit data) */
+struct usart_buffered {
+	enum usart usart;
+	struct usart_ring rx;
+	struct usart_ring tx;
+	volatile int overrun;		/* bytes lost (Rx buffer full) */
+};
+
 void usart_set_baudrate(enum usart usart, int u_pclk, int baud);
 void usart_set_databits(enum usart usart, int bits);
 void usart_set_stopbits(enum usart usart, int bits);
@@ -269,10 +288,6 @@ void usart_enable(enum usart usart);
 void usart_disable(enum usart usart);
 void usart_enable_sync_mode(enum usart usart, bool master, bool rising_edge);
 void usart_disable_sync_mode(enum usart usart);
-void usart_send(enum usart usart, int data);
-int usart_recv(enum usart usart);
-void usart_send_blocking(enum usart usart, int data);
-int usart_recv_blocking(enum usart usart);
 void usart_enable_loopback(enum usart usart);
 void usart_disable_loopback(enum usart usart);
 void usart_enable_break(enum usart usart);
@@ -283,8 +298,104 @@ void usart_disable_tx(enum usart usart);
 void usart_enable_tx(enum usart usart);
 void usart_enable_continuous_clock(enum usart usart, bool auto_clear);
 void usart_disable_continuous_clock(enum usart usart);
+void usart_buffered_init(struct usart_buffered *ub, enum usart usart,
+			 u8 *rxbuf, int rxsize, u8 *txbuf, int txsize);
+int usart_read(struct usart_buffered *ub, void *data, int size);
+int usart_write(struct usart_buffered *ub, const void *data, int size);
+void usart_buffered_isr(struct usart_buffered *ub);
+
+/*
+ * Data and interrupt functions
+ *
+ * With LPC81X_INLINE defined (-DLPC81X_INLINE) they are static inline;
+ * a constant USART number folds to its base address and usart_send()
+ * becomes a single store.  liblpc81x.a keeps the out-of-line versions.
+ */
+#ifdef LPC81X_INLINE
+#define USART_INLINE	static inline
+#else
+#define USART_INLINE
+void usart_send(enum usart usart, int data);
+int usart_recv(enum usart usart);
+void usart_send_blocking(enum usart usart, int data);
+int usart_recv_blocking(enum usart usart);
 void usart_enable_interrupt(enum usart usart, int interrupt);
 void usart_disable_interrupt(enum usart usart, int interrupt);
 int usart_get_interrupt_mask(enum usart usart, int interrupt);
 int usart_get_interrupt_status(enum usart usart, int interrupt);
 void usart_clear_interrupt(enum usart usart, int interrupt);
+#endif
+
+#if defined(LPC81X_INLINE) || defined(USART_C)
+static inline int usart_base_addr(enum usart usart)
+{
+	switch (usart) {
+	case USART0:
+		return USART0_BASE;
+	case USART1:
+		return USART1_BASE;
+	case USART2:
+		return USART2_BASE;
+	default:
+		break;
+	}
+	return 0;
+}
+
+USART_INLINE void usart_send(enum usart usart, int data)
+{
+	USART_TXDAT(usart_base_addr(usart)) = data & USART_TXDAT_MASK;
+}
+
+USART_INLINE int usart_recv(enum usart usart)
+{
+	return USART_RXDAT(usart_base_addr(usart)) & USART_RXDAT_MASK;
+}
+
+USART_INLINE void usart_send_blocking(enum usart usart, int data)
+{
+	int base;
+
+	base = usart_base_addr(usart);
+	while (!(USART_STAT(base) & USART_STAT_TXRDY))
+		;
+	USART_TXDAT(base) = data & USART_TXDAT_MASK;
+}
+
+USART_INLINE int usart_recv_blocking(enum usart usart)
+{
+	int base;
+
+	base = usart_base_addr(usart);
+	while (!(USART_STAT(base) & USART_STAT_RXRDY))
+		;
+	return USART_RXDAT(base) & USART_RXDAT_MASK;
+}
+
+USART_INLINE void usart_enable_interrupt(enum usart usart, int interrupt)
+{
+	USART_INTENSET(usart_base_addr(usart)) =
+		interrupt & USART_INTENSET_MASK;
+}
+
+USART_INLINE void usart_disable_interrupt(enum usart usart, int interrupt)
+{
+	USART_INTENCLR(usart_base_addr(usart)) =
+		interrupt & USART_INTENCLR_MASK;
+}
+
+USART_INLINE int usart_get_interrupt_mask(enum usart usart, int interrupt)
+{
+	return USART_INTENSET(usart_base_addr(usart)) & interrupt;
+}
+
+USART_INLINE int usart_get_interrupt_status(enum usart usart, int interrupt)
+{
+	return USART_INTSTAT(usart_base_addr(usart)) & interrupt;
+}
+
+USART_INLINE void usart_clear_interrupt(enum usart usart, int interrupt)
+{
+	USART_STAT(usart_base_addr(usart)) = interrupt & USART_STAT_MASK;
+}
+#endif
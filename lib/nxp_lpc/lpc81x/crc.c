@@ -17,10 +17,73 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
+
 #include <crc.h>
 
+/* The context whose state is in the engine */
+static struct crc_context *owner;
+
+/* Mode of crc_calc*(), set by crc_set_mode() */
+static int calc_mode;
+
+static u32 bitreverse(u32 v, int width)
+{
+	u32 r;
+	int i;
+
+	r = 0;
+	for (i = 0; i < width; i++) {
+		r = r << 1 | (v & 1);
+		v >>= 1;
+	}
+	return r;
+}
+
+/* CRC_SUM from CRC_SEED and vice versa */
+static u32 convert(int mode, u32 v)
+{
+	int width;
+
+	width = (mode & 3) == CRC_32 ? 32 : 16;
+	if (mode & CRC_BIT_RVS_SUM)
+		v = bitreverse(v, width);
+	if (mode & CRC_CMPL_SUM)
+		v = ~v;
+	return width == 32 ? v : v & 0xffff;
+}
+
+/*
+ * Save the state of the owner before the engine is used otherwise, and
+ * set the mode of crc_calc*() again.
+ */
+static void release(void)
+{
+	if (owner) {
+		owner->seed = convert(owner->mode, CRC_SUM);
+		owner = NULL;
+		CRC_MODE = calc_mode;
+	}
+}
+
+/*
+ * A 32-bit write is processed from bit 31 (BIT_RVS_WR reverses each
+ * byte), so a byte-swapped word equals the four byte writes.
+ */
+static void feed(const u8 *p, int len)
+{
+	for (; len > 0 && (uintptr_t)p % 4; len--)
+		CRC_WR_DATA8 = *p++;
+	for (; len >= 4; len -= 4, p += 4)
+		CRC_WR_DATA = __builtin_bswap32(*(const u32 *)p);
+	for (; len > 0; len--)
+		CRC_WR_DATA8 = *p++;
+}
+
 void crc_set_mode(int mode)
 {
+	release();
+	calc_mode = mode;
 	CRC_MODE = mode;
 }
 
@@ -28,6 +91,7 @@ int crc_calc(int crc, char *buffer, int len)
 {
 	int i;
 
+	release();
 	CRC_SEED = crc;
 	for (i = 0; i < len; i++)
 		CRC_WR_DATA8 = *buffer++;
@@ -38,6 +102,7 @@ int crc_calc16(int crc, short *buffer, int len)
 {
 	int i;
 
+	release();
 	CRC_SEED = crc;
 	for (i = 0; i < len; i++)
 		CRC_WR_DATA16 = *buffer++;
@@ -48,8 +113,43 @@ int crc_calc32(int crc, int *buffer, int len)
 {
 	int i;
 
+	release();
 	CRC_SEED = crc;
 	for (i = 0; i < len; i++)
 		CRC_WR_DATA = *buffer++;
 	return CRC_SUM;
 }
+
+/* seed: CRC_SEED value as with crc_calc() */
+void crc_init(struct crc_context *ctx, int mode, int seed)
+{
+	if (owner == ctx)
+		release();
+	ctx->mode = mode;
+	ctx->seed = seed;
+}
+
+void crc_update(struct crc_context *ctx, const void *buffer, int len)
+{
+	if (owner != ctx) {
+		release();
+		CRC_MODE = ctx->mode;
+		CRC_SEED = ctx->seed;
+		owner = ctx;
+	}
+	feed(buffer, len);
+}
+
+/* Return CRC_SUM.  The context can be updated further. */
+int crc_final(struct crc_context *ctx)
+{
+	int sum;
+
+	if (owner != ctx)
+		return convert(ctx->mode, ctx->seed);
+	sum = CRC_SUM;
+	ctx->seed = convert(ctx->mode, sum);
+	owner = NULL;
+	CRC_MODE = calc_mode;
+	return sum;
+}
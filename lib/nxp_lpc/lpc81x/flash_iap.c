@@ -0,0 +1,198 @@
+/*
+ * Flash In-Application Programming (IAP)
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <syscon.h>
+#include <flash_iap.h>
+
+#ifdef MMIO_HOST
+#define irq_save()		0
+#define irq_restore(primask)	((void)(primask))
+#else
+static inline u32 irq_save(void)
+{
+	u32 primask;
+
+	__asm__ __volatile__ ("mrs %0, primask\n\tcpsid i"
+			      : "=r" (primask) : : "memory");
+	return primask;
+}
+
+static inline void irq_restore(u32 primask)
+{
+	__asm__ __volatile__ ("msr primask, %0" : : "r" (primask) : "memory");
+}
+#endif
+
+static int iap_call(unsigned int *cmd, unsigned int *resp)
+{
+	IAP iap_entry = (IAP)IAP_LOCATION;
+	u32 primask;
+
+	primask = irq_save();
+	iap_entry(cmd, resp);
+	irq_restore(primask);
+	return resp[0];
+}
+
+/* CCLK (kHz); 0 if unknown */
+static unsigned int clock_khz(void)
+{
+	return syscon_get_system_clock() / 1000;
+}
+
+/* Sectors */
+int iap_prepare(int start, int end)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+
+	cmd[0] = IAP_PREPARE_SECTOR_FOR_WRITE_OPERATION;
+	cmd[1] = start;
+	cmd[2] = end;
+	return iap_call(cmd, resp);
+}
+
+int iap_erase_sectors(int start, int end)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+	int r;
+
+	if (clock_khz() == 0)
+		return IAP_PARAM_ERROR;
+	r = iap_prepare(start, end);
+	if (r != IAP_CMD_SUCCESS)
+		return r;
+	cmd[0] = IAP_ERASE_SECTOR;
+	cmd[1] = start;
+	cmd[2] = end;
+	cmd[3] = clock_khz();
+	return iap_call(cmd, resp);
+}
+
+/* 64-byte pages */
+int iap_erase_pages(int start, int end)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+	int pages = IAP_SECTOR_SIZE / IAP_PAGE_SIZE;
+	int r;
+
+	if (clock_khz() == 0)
+		return IAP_PARAM_ERROR;
+	r = iap_prepare(start / pages, end / pages);
+	if (r != IAP_CMD_SUCCESS)
+		return r;
+	cmd[0] = IAP_ERASE_PAGE;
+	cmd[1] = start;
+	cmd[2] = end;
+	cmd[3] = clock_khz();
+	return iap_call(cmd, resp);
+}
+
+static int copy(u32 dst, const void *src, int size)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+	int r;
+
+	if (clock_khz() == 0)
+		return IAP_PARAM_ERROR;
+	r = iap_prepare(dst / IAP_SECTOR_SIZE, dst / IAP_SECTOR_SIZE);
+	if (r != IAP_CMD_SUCCESS)
+		return r;
+	cmd[0] = IAP_COPY_RAM_TO_FLASH;
+	cmd[1] = dst;
+	cmd[2] = (uintptr_t)src;
+	cmd[3] = size;
+	cmd[4] = clock_khz();
+	return iap_call(cmd, resp);
+}
+
+/* The IAP copies to flash from SRAM only. */
+static bool in_sram(const void *p)
+{
+	return (uintptr_t)p >= SRAM_BASE && (uintptr_t)p < MTB_BASE;
+}
+
+/*
+ * Program len bytes at dst (64-byte aligned).  Consecutive pages are
+ * written with the largest copy (1024/512/256/128 bytes) the alignment
+ * of dst allows.  A source that is not in SRAM (e.g. a const table in
+ * flash) or not word aligned, and the last partial page (padded with
+ * 0xff) go through a page buffer.
+ */
+int iap_program(u32 dst, const void *src, int len)
+{
+	const u8 *p = src;
+	u32 buf[IAP_PAGE_SIZE / 4];
+	u8 *b = (u8 *)buf;
+	int size;
+	int r;
+	int i;
+
+	if (dst % IAP_PAGE_SIZE)
+		return IAP_DST_ADDR_ERROR;
+	while (len > 0) {
+		if (!in_sram(p) || (uintptr_t)p % 4 || len < IAP_PAGE_SIZE) {
+			for (i = 0; i < IAP_PAGE_SIZE; i++)
+				b[i] = i < len ? p[i] : 0xff;
+			r = copy(dst, buf, IAP_PAGE_SIZE);
+			size = IAP_PAGE_SIZE;
+		} else {
+			for (size = IAP_SECTOR_SIZE;
+			     size > len || dst % size; size /= 2)
+				;
+			r = copy(dst, p, size);
+		}
+		if (r != IAP_CMD_SUCCESS)
+			return r;
+		dst += size;
+		p += size;
+		len -= size;
+	}
+	return IAP_CMD_SUCCESS;
+}
+
+/* len: multiple of 4 */
+int iap_compare(u32 dst, const void *src, int len)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+
+	cmd[0] = IAP_COMPARE;
+	cmd[1] = dst;
+	cmd[2] = (uintptr_t)src;
+	cmd[3] = len;
+	return iap_call(cmd, resp);
+}
+
+int iap_read_uid(u32 uid[4])
+{
+	unsigned int cmd[5];
+	unsigned int resp[5];
+	int i;
+
+	cmd[0] = IAP_READ_UID;
+	if (iap_call(cmd, resp) != IAP_CMD_SUCCESS)
+		return resp[0];
+	for (i = 0; i < 4; i++)
+		uid[i] = resp[i + 1];
+	return IAP_CMD_SUCCESS;
+}
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define GPIO_C
 #include <swm.h>
 #include <iocon.h>
 #include <gpio.h>
@@ -35,25 +36,26 @@ static const int pinenable_bits[] = {
 	0, 0, 0, 0, 0, 0, 0, 0
 };
 
-static volatile u32 * const ioconp[] = {
-	&IOCON_PIO0_0,
-	&IOCON_PIO0_1,
-	&IOCON_PIO0_2,
-	&IOCON_PIO0_3,
-	&IOCON_PIO0_4,
-	&IOCON_PIO0_5,
-	&IOCON_PIO0_6,
-	&IOCON_PIO0_7,
-	&IOCON_PIO0_8,
-	&IOCON_PIO0_9,
-	&IOCON_PIO0_10,
-	&IOCON_PIO0_11,
-	&IOCON_PIO0_12,
-	&IOCON_PIO0_13,
-	&IOCON_PIO0_14,
-	&IOCON_PIO0_15,
-	&IOCON_PIO0_16,
-	&IOCON_PIO0_17
+/* IOCON register offset of each pin */
+static const u8 iocon_offset[] = {
+	0x044,		/* PIO0_0 */
+	0x02c,		/* PIO0_1 */
+	0x018,		/* PIO0_2 */
+	0x014,		/* PIO0_3 */
+	0x010,		/* PIO0_4 */
+	0x00c,		/* PIO0_5 */
+	0x040,		/* PIO0_6 */
+	0x03c,		/* PIO0_7 */
+	0x038,		/* PIO0_8 */
+	0x034,		/* PIO0_9 */
+	0x020,		/* PIO0_10 */
+	0x01c,		/* PIO0_11 */
+	0x008,		/* PIO0_12 */
+	0x004,		/* PIO0_13 */
+	0x048,		/* PIO0_14 */
+	0x028,		/* PIO0_15 */
+	0x024,		/* PIO0_16 */
+	0x000		/* PIO0_17 */
 };
 
 static int swm_enable_fixed_pin_function(enum gpio_func func)
@@ -175,7 +177,7 @@ static void iocon_set_iocon(int iocon, int pins)
 
 	for (p = 0; p < GPIO_MAXPIN; p++) {
 		if (pins & 1 << p)
-			*ioconp[p] = iocon;
+			MMIO32(IOCON_BASE + iocon_offset[p]) = iocon;
 	}
 }
 
@@ -249,80 +251,3 @@ void gpio_reconfig(enum gpio_func func, int iocon, int pins)
 		break;
 	}
 }
-
-void gpio_set(int pins)
-{
-	GPIO_SET0 = pins & 0x3ffff;
-}
-
-void gpio_clear(int pins)
-{
-	GPIO_CLR0 = pins & 0x3ffff;
-}
-
-int gpio_get(int pins)
-{
-	return GPIO_PIN0 & pins;
-}
-
-void gpio_toggle(int pins)
-{
-	GPIO_NOT0 = pins & 0x3ffff;
-}
-
-int gpio_read_port(void)
-{
-	return GPIO_PIN0;
-}
-
-void gpio_write_port(int data)
-{
-	GPIO_PIN0 = data & 0x3ffff;
-}
-
-void gpio_set_mask(int mask)
-{
-	GPIO_MASK0 = mask & 0x3ffff;
-}
-
-int gpio_read_masked_port(void)
-{
-	return GPIO_MPIN0;
-}
-
-void gpio_write_maksed_port(int data)
-{
-	GPIO_MPIN0 = data & 0x3ffff;
-}
-
-int gpio_read_pin_byte(int pin)
-{
-	if (pin < 0 || pin >= GPIO_MAXPIN)
-		return 0;
-
-	return GPIO_B(pin);
-}
-
-void gpio_write_pin_byte(int pin, int data)
-{
-	if (pin < 0 || pin >= GPIO_MAXPIN)
-		return;
-
-	GPIO_B(pin) = data;
-}
-
-int gpio_read_pin_word(int pin)
-{
-	if (pin < 0 || pin >= GPIO_MAXPIN)
-		return 0;
-
-	return GPIO_W(pin);
-}
-
-void gpio_write_pin_word(int pin, int data)
-{
-	if (pin < 0 || pin >= GPIO_MAXPIN)
-		return;
-
-	GPIO_W(pin) = data;
-}
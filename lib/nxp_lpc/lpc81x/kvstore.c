@@ -0,0 +1,344 @@
+/*
+ * Wear-leveled key/value store in flash
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include <syscon.h>
+#include <crc.h>
+#include <kvstore.h>
+
+#define KV_BLANK	0xffffffff
+#define KV_NO_KEY	0xffff
+
+/* flags */
+#define KV_DELETED	(1 << 0)
+
+/* One page */
+struct kv_record {
+	u32 seq;
+	u16 key;
+	u8 len;
+	u8 flags;
+	u8 value[KV_VALUE_MAX];
+	u32 crc;
+};
+
+static u32 page_addr(struct kv_store *kv, int page)
+{
+	return kv->base + page * KV_PAGE_SIZE;
+}
+
+static const struct kv_record *record(struct kv_store *kv, int page)
+{
+	return (const struct kv_record *)(uintptr_t)page_addr(kv, page);
+}
+
+static int erase_page(struct kv_store *kv, int page)
+{
+	int n = page_addr(kv, page) / KV_PAGE_SIZE;
+
+	return iap_erase_pages(n, n) ? KV_IAP_ERROR : 0;
+}
+
+/*
+ * CRC-32 (the one of Ethernet and zlib) of all but the last word.  A
+ * context of its own leaves the mode of crc_calc() alone.
+ */
+static u32 record_crc(const struct kv_record *r)
+{
+	struct crc_context ctx;
+
+	crc_init(&ctx, CRC_32 | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM |
+		 CRC_CMPL_SUM, 0xffffffff);
+	crc_update(&ctx, r, offsetof(struct kv_record, crc));
+	return crc_final(&ctx);
+}
+
+static bool is_blank(const struct kv_record *r)
+{
+	const u32 *p = (const u32 *)r;
+	int i;
+
+	for (i = 0; i < KV_PAGE_SIZE / 4; i++) {
+		if (p[i] != KV_BLANK)
+			return false;
+	}
+	return true;
+}
+
+static bool is_valid(const struct kv_record *r)
+{
+	return r->seq != KV_BLANK && r->key != KV_NO_KEY &&
+		r->len <= KV_VALUE_MAX && r->crc == record_crc(r);
+}
+
+static int find(struct kv_store *kv, int key)
+{
+	int i;
+
+	for (i = 0; i < kv->nkeys; i++) {
+		if (kv->index[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Slot for a new key: a free one, or that of a deleted key when the index
+ * is full.  reclaim() erases the records of a key that isn't in the
+ * index.  Return -1 if there is none.
+ */
+static int new_slot(struct kv_store *kv)
+{
+	int i;
+
+	if (kv->nkeys < KV_MAX_KEYS)
+		return kv->nkeys;
+	for (i = 0; i < kv->nkeys; i++) {
+		if (record(kv, kv->index[i].page)->flags & KV_DELETED)
+			return i;
+	}
+	return -1;
+}
+
+static int update_index(struct kv_store *kv, int key, int page)
+{
+	int i;
+
+	i = find(kv, key);
+	if (i < 0) {
+		i = new_slot(kv);
+		if (i < 0)
+			return KV_FULL;
+		if (i == kv->nkeys)
+			kv->nkeys++;
+		kv->index[i].key = key;
+	}
+	kv->index[i].page = page;
+	return 0;
+}
+
+static void remove_index(struct kv_store *kv, int i)
+{
+	kv->index[i] = kv->index[--kv->nkeys];
+}
+
+/* Program a record at the tail (a free page). */
+static int write_record(struct kv_store *kv, int key, int flags,
+			const u8 *data, int len)
+{
+	struct kv_record r;
+	int i;
+	int ret;
+
+	/* No record goes to flash that the index has no room for. */
+	if (find(kv, key) < 0 && new_slot(kv) < 0)
+		return KV_FULL;
+
+	r.seq = kv->seq;
+	r.key = key;
+	r.len = len;
+	r.flags = flags;
+	for (i = 0; i < len; i++)
+		r.value[i] = data[i];
+	for (; i < KV_VALUE_MAX; i++)
+		r.value[i] = 0xff;
+	r.crc = record_crc(&r);
+
+	if (iap_program(page_addr(kv, kv->tail), &r, KV_PAGE_SIZE))
+		return KV_IAP_ERROR;
+	if (!is_valid(record(kv, kv->tail)))
+		return KV_IAP_ERROR;
+
+	ret = update_index(kv, key, kv->tail);
+	if (ret)
+		return ret;
+	kv->seq++;
+	kv->tail = (kv->tail + 1) % kv->pages;
+	kv->used++;
+	return 0;
+}
+
+/*
+ * Erase the head page.  The record in it is moved to the tail first if it
+ * is the latest one of its key; a deleted key is forgotten as there is no
+ * older record of it any more.
+ */
+static int reclaim(struct kv_store *kv)
+{
+	const struct kv_record *r;
+	int head;
+	int i;
+	int ret;
+
+	head = kv->head;
+	r = record(kv, head);
+	if (is_valid(r)) {
+		i = find(kv, r->key);
+		if (i >= 0 && kv->index[i].page == head) {
+			if (r->flags & KV_DELETED) {
+				remove_index(kv, i);
+			} else {
+				if (kv->used == kv->pages)
+					return KV_FULL;
+				ret = write_record(kv, r->key, r->flags,
+						   r->value, r->len);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+	if (!is_blank(r) && erase_page(kv, head))
+		return KV_IAP_ERROR;
+	kv->head = (head + 1) % kv->pages;
+	kv->used--;
+	return 0;
+}
+
+static int append(struct kv_store *kv, int key, int flags,
+		  const u8 *data, int len)
+{
+	int ret;
+
+	/* Keep a free page for the move in reclaim(). */
+	while (kv->pages - kv->used < 2) {
+		ret = reclaim(kv);
+		if (ret)
+			return ret;
+	}
+	return write_record(kv, key, flags, data, len);
+}
+
+/*
+ * base: start address of the region (1 KB aligned)
+ * sectors: number of 1 KB sectors (2 or more)
+ */
+int kv_init(struct kv_store *kv, u32 base, int sectors)
+{
+	const struct kv_record *r;
+	u32 max;
+	int last;
+	int page;
+	int i;
+
+	if (base % KV_SECTOR_SIZE || sectors < 2)
+		return KV_INVALID;
+
+	syscon_enable_clock(SYSCON_CRC);
+
+	kv->base = base;
+	kv->pages = sectors * (KV_SECTOR_SIZE / KV_PAGE_SIZE);
+	kv->nkeys = 0;
+
+	/* The newest record is just before the tail. */
+	last = -1;
+	max = 0;
+	for (page = 0; page < kv->pages; page++) {
+		r = record(kv, page);
+		if (is_valid(r) && (last < 0 || r->seq > max)) {
+			max = r->seq;
+			last = page;
+		}
+	}
+	if (last < 0) {
+		kv->seq = 0;
+		kv->tail = 0;
+	} else {
+		kv->seq = max + 1;
+		kv->tail = (last + 1) % kv->pages;
+	}
+
+	/* A write interrupted by a reset */
+	r = record(kv, kv->tail);
+	if (!is_blank(r) && !is_valid(r) && erase_page(kv, kv->tail))
+		return KV_IAP_ERROR;
+
+	/* The free pages end at the head. */
+	for (i = 0; i < kv->pages; i++) {
+		if (!is_blank(record(kv, (kv->tail + i) % kv->pages)))
+			break;
+	}
+	kv->head = (kv->tail + i) % kv->pages;
+	kv->used = kv->pages - i;
+
+	/* From the oldest record to the newest */
+	for (i = 0; i < kv->used; i++) {
+		page = (kv->head + i) % kv->pages;
+		r = record(kv, page);
+		if (is_valid(r) && update_index(kv, r->key, page))
+			return KV_FULL;
+	}
+	return 0;
+}
+
+/* Return the length of the value, or KV_NOT_FOUND. */
+int kv_get(struct kv_store *kv, int key, void *data, int size)
+{
+	const struct kv_record *r;
+	u8 *p = data;
+	int i;
+
+	i = find(kv, key);
+	if (i < 0)
+		return KV_NOT_FOUND;
+	r = record(kv, kv->index[i].page);
+	if (r->flags & KV_DELETED)
+		return KV_NOT_FOUND;
+	for (i = 0; i < r->len && i < size; i++)
+		p[i] = r->value[i];
+	return r->len;
+}
+
+/* Nothing is written if the value is unchanged. */
+int kv_set(struct kv_store *kv, int key, const void *data, int len)
+{
+	const struct kv_record *r;
+	const u8 *p = data;
+	int i;
+
+	if (key < 0 || key >= KV_NO_KEY || len < 0 || len > KV_VALUE_MAX)
+		return KV_INVALID;
+
+	i = find(kv, key);
+	if (i < 0) {
+		if (new_slot(kv) < 0)
+			return KV_FULL;
+	} else {
+		r = record(kv, kv->index[i].page);
+		if (!(r->flags & KV_DELETED) && r->len == len) {
+			for (i = 0; i < len; i++) {
+				if (r->value[i] != p[i])
+					break;
+			}
+			if (i == len)
+				return 0;
+		}
+	}
+	return append(kv, key, 0, p, len);
+}
+
+int kv_delete(struct kv_store *kv, int key)
+{
+	int i;
+
+	i = find(kv, key);
+	if (i < 0 || record(kv, kv->index[i].page)->flags & KV_DELETED)
+		return KV_NOT_FOUND;
+	return append(kv, key, KV_DELETED, NULL, 0);
+}
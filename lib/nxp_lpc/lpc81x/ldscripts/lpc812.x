@@ -31,7 +31,8 @@ REGION_ALIAS("REGION_RODATA", ROM);
 REGION_ALIAS("REGION_DATA", RAM);
 REGION_ALIAS("REGION_BSS", RAM);
 
-_stack = ORIGIN(RAM) + LENGTH(RAM);
+/* The top 32 bytes of RAM are used by the IAP (flash_iap, kvstore). */
+_stack = ORIGIN(RAM) + LENGTH(RAM) - 32;
 
 EXTERN(_vector);
 /* EXTERN(_crp); */
@@ -53,19 +54,36 @@ SECTIONS
 		*(.rodata*)
 	} > REGION_RODATA
 	. = .;			/* Orphan sections */
-	_rodata_end = .;
-	.data : AT (_rodata_end)
+	_rodata_end = ALIGN(4);
+	/* Word aligned, so that _reset() can copy and clear by words */
+	.ramfunc : AT (_rodata_end)
 	{
+		. = ALIGN(4);
+		_ramfunc_start = .;
+		*(.ramfunc*)
+		. = ALIGN(4);
+		_ramfunc_end = .;
+	} > REGION_DATA
+	_ramfunc_size = SIZEOF(.ramfunc);
+	_ramfunc_load_start = LOADADDR(.ramfunc);
+	.data : AT (_ramfunc_load_start + _ramfunc_size)
+	{
+		. = ALIGN(4);
 		_data_start = .;
 		*(.data*)
+		. = ALIGN(4);
+		_data_end = .;
 	} > REGION_DATA
 	_data_size = SIZEOF(.data);
 	_data_load_start = LOADADDR(.data);
 	.bss :
 	{
+		. = ALIGN(4);
 		_bss_start = .;
 		*(.bss*)
 		*(COMMON)
+		. = ALIGN(4);
+		_bss_end = .;
 	} > REGION_BSS
 	. = .;
 	PROVIDE(end = ALIGN(4));
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# RAM usage of an image linked with lpc810.x, lpc811.x or lpc812.x
+
+# Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Usage: ram-report.sh <elf>
+# Prints the SRAM taken by .ramfunc, .data and .bss and what is left for
+# the stack, where _reset() copies .ramfunc and .data from, and the
+# veneers of calls between flash and SRAM.  Fails if the load images of
+# .ramfunc and .data don't follow .rodata.  NM selects the nm program
+# (default: arm-none-eabi-nm).
+
+NM=${NM:-arm-none-eabi-nm}
+
+if [ $# -ne 1 ]; then
+	echo "Usage: $0 <elf>" >&2
+	exit 1
+fi
+
+$NM "$1" | awk '
+	function hex(s,  i, n) {
+		n = 0
+		for (i = 1; i <= length(s); i++)
+			n = n * 16 + index("0123456789abcdef",
+					   tolower(substr(s, i, 1))) - 1
+		return n
+	}
+	$3 ~ /_veneer$/ { veneers = veneers " " $3 }
+	{ sym[$3] = hex($1) }
+	END {
+		ram = hex("10000000")
+		ramfunc = sym["_ramfunc_size"]
+		data = sym["_data_size"]
+		bss = sym["_bss_size"]
+		used = ramfunc + data + bss
+		size = sym["_stack"] - ram
+		printf("  RAM: ramfunc %d + data %d + bss %d = %d of %d bytes" \
+		       " (%d left for the stack)\n",
+		       ramfunc, data, bss, used, size, size - used)
+		printf("  Copied by _reset(): ramfunc 0x%08x -> 0x%08x," \
+		       " data 0x%08x -> 0x%08x\n",
+		       sym["_ramfunc_load_start"], sym["_ramfunc_start"],
+		       sym["_data_load_start"], sym["_data_start"])
+		printf("  Veneers:%s\n", veneers == "" ? " none" : veneers)
+		if (sym["_ramfunc_load_start"] != sym["_rodata_end"] ||
+		    sym["_data_load_start"] != sym["_rodata_end"] + ramfunc) {
+			printf("  .ramfunc and .data are not loaded after" \
+			       " .rodata (0x%08x)\n", sym["_rodata_end"])
+			exit 1
+		}
+	}'
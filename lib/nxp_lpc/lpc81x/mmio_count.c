@@ -0,0 +1,176 @@
+/*
+ * Register access accounting
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mmio_count.h>
+
+#define MAX_FUNCTIONS	512
+#define MAX_SITES	2048
+
+#define NO_INSTRUMENT	__attribute__ ((no_instrument_function))
+
+struct function {
+	void *addr;
+	char name[24];		/* if dladdr() fails */
+};
+
+static struct mmio_count function_table[MAX_FUNCTIONS];
+static struct function function_addr[MAX_FUNCTIONS];
+static int nfunctions;
+static struct mmio_count site_table[MAX_SITES];
+static int nsites;
+
+static int depth;			/* library call depth */
+static struct mmio_count *current;	/* outermost library function */
+
+/* The access in progress */
+static struct mmio_count *site;
+static struct mmio_count *function;
+
+void __cyg_profile_func_enter(void *fn, void *caller) NO_INSTRUMENT;
+void __cyg_profile_func_exit(void *fn, void *caller) NO_INSTRUMENT;
+
+static struct mmio_count *lookup_function(void *fn)
+{
+	struct mmio_count *c;
+	struct function *f;
+	Dl_info info;
+	int i;
+
+	for (i = 0; i < nfunctions; i++) {
+		if (function_addr[i].addr == fn)
+			return &function_table[i];
+	}
+	if (nfunctions >= MAX_FUNCTIONS)
+		return NULL;
+
+	c = &function_table[nfunctions];
+	f = &function_addr[nfunctions++];
+	f->addr = fn;
+	if (dladdr(fn, &info) && info.dli_sname) {
+		c->function = info.dli_sname;
+	} else {
+		snprintf(f->name, sizeof(f->name), "%p", fn);
+		c->function = f->name;
+	}
+	return c;
+}
+
+void __cyg_profile_func_enter(void *fn, void *caller)
+{
+	(void)caller;
+	if (depth++)
+		return;
+	current = lookup_function(fn);
+	if (current)
+		current->calls++;
+}
+
+void __cyg_profile_func_exit(void *fn, void *caller)
+{
+	(void)fn;
+	(void)caller;
+	if (--depth)
+		return;
+	/* Complete the last access of the function. */
+	mmio_host_sync();
+	current = NULL;
+}
+
+static struct mmio_count *lookup_site(const char *file, int line,
+				      const char *func)
+{
+	struct mmio_count *c;
+	int i;
+
+	for (i = 0; i < nsites; i++) {
+		c = &site_table[i];
+		if (c->line == line && !strcmp(c->file, file))
+			return c;
+	}
+	if (nsites >= MAX_SITES)
+		return NULL;
+
+	c = &site_table[nsites++];
+	c->function = func;
+	c->file = file;
+	c->line = line;
+	return c;
+}
+
+volatile void *mmio_count_map(u32 addr, int size, const char *file, int line,
+			      const char *func)
+{
+	mmio_host_sync();
+	site = lookup_site(file, line, func);
+	function = current;
+	return mmio_host_map(addr, size);
+}
+
+void mmio_count_access(bool load, bool store)
+{
+	if (site) {
+		site->loads += load;
+		site->stores += store;
+	}
+	if (function) {
+		function->loads += load;
+		function->stores += store;
+	}
+	site = NULL;
+	function = NULL;
+}
+
+/* Clear the counters (the tables are kept). */
+void mmio_count_reset(void)
+{
+	int i;
+
+	mmio_host_sync();
+	for (i = 0; i < nfunctions; i++) {
+		function_table[i].calls = 0;
+		function_table[i].loads = 0;
+		function_table[i].stores = 0;
+	}
+	for (i = 0; i < nsites; i++) {
+		site_table[i].loads = 0;
+		site_table[i].stores = 0;
+	}
+}
+
+/* Functions in the order of the first call */
+int mmio_count_functions(const struct mmio_count **table)
+{
+	mmio_host_sync();
+	*table = function_table;
+	return nfunctions;
+}
+
+/* Call sites in the order of the first access */
+int mmio_count_sites(const struct mmio_count **table)
+{
+	mmio_host_sync();
+	*table = site_table;
+	return nsites;
+}
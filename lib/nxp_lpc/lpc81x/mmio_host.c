@@ -0,0 +1,802 @@
+/*
+ * Host register model
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * mmio_host_map() gives the driver a cell holding the value of the
+ * register.  The driver reads it and/or stores into it; the store is
+ * applied to the register file (through the write hook, if any) when the
+ * next access starts or at mmio_host_sync().
+ *
+ * The cell has a page of its own, which is read-only while the driver
+ * holds it, so a store faults and is seen even if it writes the value
+ * that was read.
+ */
+
+#ifdef MMIO_COUNT
+#define _GNU_SOURCE
+#include <ucontext.h>
+#endif
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mmio_host.h>
+#include <memorymap.h>
+#ifdef MMIO_COUNT
+#include <mmio_count.h>
+#endif
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1 << PAGE_SHIFT)
+#define HASH_SIZE	64
+#define MAX_HOOKS	64
+#define QUEUE_SIZE	256	/* power of 2 */
+
+/* Register file (sparse, 4 KB pages) */
+struct page {
+	u32 addr;
+	struct page *next;
+	u8 data[PAGE_SIZE];
+};
+
+struct hook {
+	u32 addr;
+	u32 size;
+	mmio_host_read_t read;
+	mmio_host_write_t write;
+	void *ctx;
+};
+
+struct queue {
+	u32 buf[QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+};
+
+/* USART or SPI */
+struct serial {
+	u32 base;
+	struct queue in;	/* received by the device */
+	struct queue out;	/* sent by the device */
+	u32 rxdat;		/* SPI: last frame received */
+	bool rxrdy;
+};
+
+static bool initialized;
+static struct page *page_table[HASH_SIZE];
+static struct hook hook_table[MAX_HOOKS];
+static int nhooks;
+static struct serial usart_model[3];
+static struct serial spi_model[2];
+
+union cell {
+	u8 b;
+	u16 h;
+	u32 w;
+};
+
+/* The access in progress */
+static struct {
+	bool active;
+	u32 addr;
+	int size;
+	u32 value;		/* value given to the driver */
+	struct hook *hook;
+} acc;
+
+#ifdef MMIO_COUNT
+/*
+ * In the count build the page is closed while the driver holds it, so
+ * the first load faults as well; the handler records it and opens the
+ * page read-only.  The kind of fault is taken from the x86 page fault
+ * error code, so the count build is x86 only: counting every first fault
+ * as a load would disagree with baseline.txt.
+ */
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "MMIO_COUNT needs the x86 page fault error code"
+#endif
+
+static volatile sig_atomic_t loaded;
+#endif
+
+static union cell *cell;
+static long page_size;
+static volatile sig_atomic_t stored;
+
+static void guard_handler(int sig, siginfo_t *si, void *uc)
+{
+	(void)uc;
+	if ((char *)si->si_addr < (char *)cell ||
+	    (char *)si->si_addr >= (char *)cell + page_size) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+#ifdef MMIO_COUNT
+	if (!loaded && !stored &&
+	    !(((ucontext_t *)uc)->uc_mcontext.gregs[REG_ERR] & 2)) {
+		loaded = 1;
+		mprotect(cell, page_size, PROT_READ);
+		return;
+	}
+#endif
+	stored = 1;
+	mprotect(cell, page_size, PROT_READ | PROT_WRITE);
+}
+
+static void guard_init(void)
+{
+	struct sigaction sa;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	cell = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (cell == MAP_FAILED)
+		abort();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = guard_handler;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigaction(SIGSEGV, &sa, NULL);
+}
+
+static void guard(void)
+{
+	stored = 0;
+#ifdef MMIO_COUNT
+	loaded = 0;
+	mprotect(cell, page_size, PROT_NONE);
+#else
+	mprotect(cell, page_size, PROT_READ);
+#endif
+}
+
+static void unguard(void)
+{
+	mprotect(cell, page_size, PROT_READ | PROT_WRITE);
+}
+
+static u8 *locate(u32 addr)
+{
+	struct page **pp;
+	struct page *p;
+	u32 a;
+
+	a = addr & ~(PAGE_SIZE - 1);
+	pp = &page_table[(a >> PAGE_SHIFT) % HASH_SIZE];
+	for (p = *pp; p; p = p->next) {
+		if (p->addr == a)
+			return &p->data[addr - a];
+	}
+
+	p = calloc(1, sizeof(struct page));
+	if (p == NULL)
+		abort();
+	p->addr = a;
+	p->next = *pp;
+	*pp = p;
+	return &p->data[addr - a];
+}
+
+static u32 load(u32 addr, int size)
+{
+	u8 *p;
+
+	p = locate(addr);
+	if (size == 1)
+		return *p;
+	if (size == 2)
+		return p[0] | p[1] << 8;
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static void store(u32 addr, int size, u32 value)
+{
+	u8 *p;
+	int i;
+
+	p = locate(addr);
+	for (i = 0; i < size; i++)
+		p[i] = value >> (i * 8);
+}
+
+static struct hook *find_hook(u32 addr)
+{
+	int i;
+
+	for (i = 0; i < nhooks; i++) {
+		if (addr >= hook_table[i].addr &&
+		    addr - hook_table[i].addr < hook_table[i].size)
+			return &hook_table[i];
+	}
+	return NULL;
+}
+
+static u32 size_mask(int size)
+{
+	return size == 4 ? 0xffffffff : (1U << (size * 8)) - 1;
+}
+
+volatile void *mmio_host_map(u32 addr, int size)
+{
+	struct hook *h;
+	u32 v;
+
+	if (!initialized)
+		mmio_host_reset();
+	mmio_host_sync();
+
+	h = find_hook(addr);
+	v = load(addr, size);
+	if (h && h->read)
+		v = h->read(h->ctx, addr, v);
+	v &= size_mask(size);
+
+	acc.active = true;
+	acc.addr = addr;
+	acc.size = size;
+	acc.value = v;
+	acc.hook = h;
+	if (size == 1)
+		cell->b = v;
+	else if (size == 2)
+		cell->h = v;
+	else
+		cell->w = v;
+	guard();
+	return cell;
+}
+
+/* Apply the store of the last access (if any). */
+void mmio_host_sync(void)
+{
+	u32 v;
+
+	if (!acc.active)
+		return;
+	acc.active = false;
+	unguard();
+#ifdef MMIO_COUNT
+	mmio_count_access(loaded, stored);
+#endif
+
+	if (acc.size == 1)
+		v = cell->b;
+	else if (acc.size == 2)
+		v = cell->h;
+	else
+		v = cell->w;
+	if (!stored)
+		return;
+
+	if (acc.hook && acc.hook->write)
+		acc.hook->write(acc.hook->ctx, acc.addr, v);
+	else
+		store(acc.addr, acc.size, v);
+}
+
+/* Register value without side effects */
+u32 mmio_host_peek(u32 addr)
+{
+	mmio_host_sync();
+	return load(addr, 4);
+}
+
+void mmio_host_poke(u32 addr, u32 value)
+{
+	mmio_host_sync();
+	store(addr, 4, value);
+}
+
+int mmio_host_add_hook(u32 addr, u32 size, mmio_host_read_t read,
+		       mmio_host_write_t write, void *ctx)
+{
+	struct hook *h;
+
+	if (nhooks >= MAX_HOOKS)
+		return -1;
+	h = &hook_table[nhooks++];
+	h->addr = addr;
+	h->size = size;
+	h->read = read;
+	h->write = write;
+	h->ctx = ctx;
+	return 0;
+}
+
+/* --- Queues -------------------------------------------------------------- */
+
+static int queue_put(struct queue *q, u32 v)
+{
+	if (q->tail - q->head >= QUEUE_SIZE)
+		return -1;
+	q->buf[q->tail++ & (QUEUE_SIZE - 1)] = v;
+	return 0;
+}
+
+static int queue_get(struct queue *q, u32 *v)
+{
+	if (q->head == q->tail)
+		return -1;
+	*v = q->buf[q->head++ & (QUEUE_SIZE - 1)];
+	return 0;
+}
+
+/* --- SYSCON -------------------------------------------------------------- */
+
+/* SYSPLLSTAT: the PLL locks at once. */
+static u32 syscon_pllstat_read(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	(void)addr;
+	(void)value;
+	return 1;
+}
+
+/* --- GPIO ---------------------------------------------------------------- */
+
+#define GPIO_PIN_ADDR	(GPIO_BASE + 0x2100)
+
+static u32 gpio_b_read(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	(void)value;
+	return load(GPIO_PIN_ADDR, 4) >> (addr - GPIO_BASE) & 1;
+}
+
+static void gpio_b_write(void *ctx, u32 addr, u32 value)
+{
+	u32 pin;
+
+	(void)ctx;
+	pin = load(GPIO_PIN_ADDR, 4);
+	if (value & 1)
+		pin |= 1 << (addr - GPIO_BASE);
+	else
+		pin &= ~(1 << (addr - GPIO_BASE));
+	store(GPIO_PIN_ADDR, 4, pin);
+}
+
+static u32 gpio_w_read(void *ctx, u32 addr, u32 value)
+{
+	return gpio_b_read(ctx, GPIO_BASE + (addr - GPIO_BASE - 0x1000) / 4,
+			   value) ? 0xffffffff : 0;
+}
+
+static void gpio_w_write(void *ctx, u32 addr, u32 value)
+{
+	gpio_b_write(ctx, GPIO_BASE + (addr - GPIO_BASE - 0x1000) / 4,
+		     value != 0);
+}
+
+/* SET reads as PIN; CLR and NOT read as 0. */
+static u32 gpio_set_read(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	(void)addr;
+	(void)value;
+	return load(GPIO_PIN_ADDR, 4);
+}
+
+static u32 gpio_zero_read(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	(void)addr;
+	(void)value;
+	return 0;
+}
+
+static void gpio_set_write(void *ctx, u32 addr, u32 value)
+{
+	u32 pin;
+
+	(void)ctx;
+	pin = load(GPIO_PIN_ADDR, 4);
+	switch (addr - GPIO_BASE) {
+	case 0x2200:
+		pin |= value;
+		break;
+	case 0x2280:
+		pin &= ~value;
+		break;
+	default:
+		pin ^= value;
+		break;
+	}
+	store(GPIO_PIN_ADDR, 4, pin);
+}
+
+/* --- USART --------------------------------------------------------------- */
+
+#define STAT		0x08
+#define INTENSET	0x0c
+#define INTENCLR	0x10
+#define RXDAT		0x14
+#define RXDATSTAT	0x18
+#define TXDAT		0x1c
+#define USART_INTSTAT	0x24
+
+/* Transmission completes at once. */
+static u32 usart_status(struct serial *s)
+{
+	u32 v;
+
+	v = load(s->base + STAT, 4) | 1 << 2 | 1 << 3;	/* TXRDY, TXIDLE */
+	if (s->in.head != s->in.tail)
+		v |= 1 << 0;				/* RXRDY */
+	else
+		v |= 1 << 1;				/* RXIDLE */
+	return v;
+}
+
+static u32 usart_read(void *ctx, u32 addr, u32 value)
+{
+	struct serial *s = ctx;
+	u32 v;
+
+	switch (addr - s->base) {
+	case STAT:
+	case TXDAT:
+		return usart_status(s);
+	case INTENCLR:
+		return 0;
+	case RXDAT:
+	case RXDATSTAT:
+		if (queue_get(&s->in, &v))
+			return 0;
+		return v;
+	case USART_INTSTAT:
+		return usart_status(s) & load(s->base + INTENSET, 4);
+	default:
+		return value;
+	}
+}
+
+static void usart_write(void *ctx, u32 addr, u32 value)
+{
+	struct serial *s = ctx;
+
+	switch (addr - s->base) {
+	case STAT:
+		store(addr, 4, load(addr, 4) & ~value);
+		break;
+	case INTENSET:
+		store(addr, 4, load(addr, 4) | value);
+		break;
+	case INTENCLR:
+		store(s->base + INTENSET, 4,
+		      load(s->base + INTENSET, 4) & ~value);
+		break;
+	case TXDAT:
+		queue_put(&s->out, value & 0x1ff);
+		break;
+	case RXDAT:
+	case RXDATSTAT:
+	case USART_INTSTAT:
+		break;
+	default:
+		store(addr, 4, value);
+		break;
+	}
+}
+
+/* --- SPI ----------------------------------------------------------------- */
+
+#define TXDATCTL	0x18
+#define SPI_INTSTAT	0x28
+
+static u32 spi_status(struct serial *s)
+{
+	u32 v;
+
+	v = load(s->base + STAT, 4) | 1 << 1 | 1 << 8;	/* TXRDY, MSTIDLE */
+	if (s->rxrdy)
+		v |= 1 << 0;				/* RXRDY */
+	return v;
+}
+
+/* A frame is received (0xffff if no input) for each frame sent. */
+static void spi_transfer(struct serial *s, u32 data)
+{
+	u32 v;
+
+	queue_put(&s->out, data & 0xffff);
+	if (queue_get(&s->in, &v))
+		v = 0xffff;
+	if (s->rxrdy)
+		store(s->base + STAT, 4,
+		      load(s->base + STAT, 4) | 1 << 2);	/* RXOV */
+	s->rxdat = v & 0xffff;
+	s->rxrdy = true;
+}
+
+static u32 spi_read(void *ctx, u32 addr, u32 value)
+{
+	struct serial *s = ctx;
+
+	switch (addr - s->base) {
+	case STAT:
+	case TXDATCTL:
+	case TXDAT:
+		return spi_status(s);
+	case INTENCLR:
+		return 0;
+	case RXDAT:
+		s->rxrdy = false;
+		return s->rxdat;
+	case SPI_INTSTAT:
+		return spi_status(s) & load(s->base + INTENSET, 4);
+	default:
+		return value;
+	}
+}
+
+static void spi_write(void *ctx, u32 addr, u32 value)
+{
+	struct serial *s = ctx;
+
+	switch (addr - s->base) {
+	case STAT:
+		store(addr, 4, load(addr, 4) & ~value);
+		break;
+	case INTENSET:
+		store(addr, 4, load(addr, 4) | value);
+		break;
+	case INTENCLR:
+		store(s->base + INTENSET, 4,
+		      load(s->base + INTENSET, 4) & ~value);
+		break;
+	case TXDATCTL:
+	case TXDAT:
+		spi_transfer(s, value);
+		break;
+	case RXDAT:
+	case SPI_INTSTAT:
+		break;
+	default:
+		store(addr, 4, value);
+		break;
+	}
+}
+
+/* --- CRC engine ---------------------------------------------------------- */
+
+#define CRC_MODE_REG	0x00
+#define CRC_SEED_REG	0x04
+#define CRC_DATA_REG	0x08	/* CRC_SUM and CRC_WR_DATA */
+
+static const u32 crc_poly[] = {0x1021, 0x8005, 0x04c11db7, 0x04c11db7};
+
+static struct {
+	u32 mode;
+	u32 state;		/* CRC_SEED form */
+} crc_engine;
+
+static int crc_width(void)
+{
+	return (crc_engine.mode & 3) >= 2 ? 32 : 16;
+}
+
+static u32 crc_mask(void)
+{
+	return crc_width() == 32 ? 0xffffffff : 0xffff;
+}
+
+static u32 crc_reverse(u32 v, int bits)
+{
+	u32 r;
+	int i;
+
+	r = 0;
+	for (i = 0; i < bits; i++, v >>= 1)
+		r = r << 1 | (v & 1);
+	return r;
+}
+
+static u32 crc_sum(void)
+{
+	u32 v = crc_engine.state;
+
+	if (crc_engine.mode & 1 << 4)			/* BIT_RVS_SUM */
+		v = crc_reverse(v, crc_width());
+	if (crc_engine.mode & 1 << 5)			/* CMPL_SUM */
+		v = ~v;
+	return v & crc_mask();
+}
+
+/* A write of size bytes is shifted in from its top bit. */
+static void crc_write_data(u32 data, int size)
+{
+	u32 poly;
+	u32 top;
+	u32 s;
+	u32 r;
+	int i;
+
+	if (crc_engine.mode & 1 << 3)			/* CMPL_WR */
+		data = ~data;
+	if (crc_engine.mode & 1 << 2) {			/* BIT_RVS_WR */
+		r = 0;
+		for (i = 0; i < size; i++)
+			r |= crc_reverse(data >> (i * 8), 8) << (i * 8);
+		data = r;
+	}
+
+	poly = crc_poly[crc_engine.mode & 3];
+	top = 1U << (crc_width() - 1);
+	s = crc_engine.state;
+	for (i = size * 8 - 1; i >= 0; i--) {
+		if (!(s & top) != !(data >> i & 1))
+			s = s << 1 ^ poly;
+		else
+			s <<= 1;
+	}
+	crc_engine.state = s & crc_mask();
+}
+
+static u32 crc_read(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	switch (addr - CRC_BASE) {
+	case CRC_MODE_REG:
+		return crc_engine.mode;
+	case CRC_SEED_REG:
+		return crc_engine.state;
+	case CRC_DATA_REG:
+		return crc_sum();
+	}
+	return value;
+}
+
+static void crc_write(void *ctx, u32 addr, u32 value)
+{
+	(void)ctx;
+	switch (addr - CRC_BASE) {
+	case CRC_MODE_REG:
+		crc_engine.mode = value & 0x3f;
+		break;
+	case CRC_SEED_REG:
+		crc_engine.state = value & crc_mask();
+		break;
+	case CRC_DATA_REG:
+		crc_write_data(value, acc.size);
+		break;
+	}
+}
+
+/* --- Setup and test interface -------------------------------------------- */
+
+static const u32 usart_base[] = {USART0_BASE, USART1_BASE, USART2_BASE};
+static const u32 spi_base[] = {SPI0_BASE, SPI1_BASE};
+
+/* Clear every register and (re)install the models. */
+void mmio_host_reset(void)
+{
+	struct page *p;
+	struct page *next;
+	int i;
+
+	for (i = 0; i < HASH_SIZE; i++) {
+		for (p = page_table[i]; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+		page_table[i] = NULL;
+	}
+	memset(&acc, 0, sizeof(acc));
+	nhooks = 0;
+	if (!initialized)
+		guard_init();
+	initialized = true;
+
+	mmio_host_add_hook(SYSCON_BASE + 0x00c, 4, syscon_pllstat_read, NULL,
+			   NULL);
+
+	mmio_host_add_hook(GPIO_BASE, 18, gpio_b_read, gpio_b_write, NULL);
+	mmio_host_add_hook(GPIO_BASE + 0x1000, 18 * 4, gpio_w_read,
+			   gpio_w_write, NULL);
+	mmio_host_add_hook(GPIO_BASE + 0x2200, 4, gpio_set_read,
+			   gpio_set_write, NULL);
+	mmio_host_add_hook(GPIO_BASE + 0x2280, 4, gpio_zero_read,
+			   gpio_set_write, NULL);
+	mmio_host_add_hook(GPIO_BASE + 0x2300, 4, gpio_zero_read,
+			   gpio_set_write, NULL);
+
+	memset(&crc_engine, 0, sizeof(crc_engine));
+	mmio_host_add_hook(CRC_BASE, 0x0c, crc_read, crc_write, NULL);
+
+	for (i = 0; i < 3; i++) {
+		memset(&usart_model[i], 0, sizeof(struct serial));
+		usart_model[i].base = usart_base[i];
+		mmio_host_add_hook(usart_base[i], 0x40, usart_read,
+				   usart_write, &usart_model[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		memset(&spi_model[i], 0, sizeof(struct serial));
+		spi_model[i].base = spi_base[i];
+		mmio_host_add_hook(spi_base[i], 0x40, spi_read, spi_write,
+				   &spi_model[i]);
+	}
+}
+
+int mmio_host_usart_input(int usart, const u8 *data, int size)
+{
+	int i;
+
+	if (usart < 0 || usart > 2)
+		return -1;
+	if (!initialized)
+		mmio_host_reset();
+	mmio_host_sync();
+	for (i = 0; i < size; i++) {
+		if (queue_put(&usart_model[usart].in, data[i]))
+			break;
+	}
+	return i;
+}
+
+int mmio_host_usart_output(int usart, u8 *data, int size)
+{
+	u32 v;
+	int i;
+
+	if (usart < 0 || usart > 2)
+		return -1;
+	mmio_host_sync();
+	for (i = 0; i < size; i++) {
+		if (queue_get(&usart_model[usart].out, &v))
+			break;
+		data[i] = v;
+	}
+	return i;
+}
+
+int mmio_host_spi_input(int spi, const u16 *data, int size)
+{
+	int i;
+
+	if (spi < 0 || spi > 1)
+		return -1;
+	if (!initialized)
+		mmio_host_reset();
+	mmio_host_sync();
+	for (i = 0; i < size; i++) {
+		if (queue_put(&spi_model[spi].in, data[i]))
+			break;
+	}
+	return i;
+}
+
+int mmio_host_spi_output(int spi, u16 *data, int size)
+{
+	u32 v;
+	int i;
+
+	if (spi < 0 || spi > 1)
+		return -1;
+	mmio_host_sync();
+	for (i = 0; i < size; i++) {
+		if (queue_get(&spi_model[spi].out, &v))
+			break;
+		data[i] = v;
+	}
+	return i;
+}
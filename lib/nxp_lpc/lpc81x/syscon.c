@@ -195,6 +195,63 @@ void syscon_set_system_clock(enum syscon_osc source, int div)
 	SYSCON_SYSAHBCLKDIV = div;
 }
 
+/* Frequency of the crystal or CLKIN (0: not set) */
+static int external_clock;
+
+void syscon_set_external_clock(int freq)
+{
+	external_clock = freq;
+}
+
+/* Watchdog oscillator analog output (kHz) */
+static const u16 fclkana_khz[] = {
+	0, 600, 1050, 1400, 1750, 2100, 2400, 2700,
+	3000, 3250, 3500, 3750, 4000, 4200, 4400, 4600
+};
+
+static int pll_in_clock(void)
+{
+	if ((SYSCON_SYSPLLCLKSEL & 3) == SYSCON_SYSPLLCLKSEL_SEL_IRC)
+		return 12000000;
+	return external_clock;
+}
+
+/*
+ * Return the system clock frequency (Hz) from the SYSCON registers, or 0
+ * if it comes from the crystal or CLKIN and syscon_set_external_clock()
+ * hasn't been called.
+ */
+int syscon_get_system_clock(void)
+{
+	int main_clock;
+	int ctrl;
+	int div;
+
+	switch (SYSCON_MAINCLKSEL & 3) {
+	case SYSCON_MAINCLKSEL_SEL_IRC:
+		main_clock = 12000000;
+		break;
+	case SYSCON_MAINCLKSEL_SEL_PLL_IN:
+		main_clock = pll_in_clock();
+		break;
+	case SYSCON_MAINCLKSEL_SEL_WDT_OSC:
+		ctrl = SYSCON_WDTOSCCTRL;
+		/* wdt_osc_clk = Fclkana / (2 * (1 + DIVSEL)) */
+		main_clock = fclkana_khz[(ctrl >> 5) & 0xf] * 1000 /
+			(2 * (1 + (ctrl & 0x1f)));
+		break;
+	default:
+		/* FCLKOUT = M * FCLKIN */
+		main_clock = pll_in_clock() * ((SYSCON_SYSPLLCTRL & 0x1f) + 1);
+		break;
+	}
+
+	div = SYSCON_SYSAHBCLKDIV & 0xff;
+	if (div == 0)
+		return 0;
+	return main_clock / div;
+}
+
 void syscon_enable_clock(int peripheral)
 {
 	SYSCON_SYSAHBCLKCTRL |= peripheral & 0xfffff;
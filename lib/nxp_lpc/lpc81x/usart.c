@@ -17,26 +17,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define USART_C
 #include <usart.h>
 
-static int base_addr(enum usart usart)
-{
-	switch (usart) {
-	case USART0:
-		return USART0_BASE;
-	case USART1:
-		return USART1_BASE;
-	case USART2:
-		return USART2_BASE;
-	default:
-		break;
-	}
-	return 0;
-}
+/* Keep the compiler from reordering buffer and index accesses. */
+#define barrier()	__asm__ __volatile__ ("" : : : "memory")
 
 void usart_set_baudrate(enum usart usart, int u_pclk, int baud)
 {
-	USART_BRG(base_addr(usart)) = (u_pclk / (16 * baud) - 1) &
+	USART_BRG(usart_base_addr(usart)) = (u_pclk / (16 * baud) - 1) &
 		USART_BRG_MASK;
 }
 
@@ -45,7 +34,7 @@ void usart_set_databits(enum usart usart, int bits)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	if (bits == 9) {
 		r |= USART_CFG_DATALEN1;
@@ -64,7 +53,7 @@ void usart_set_stopbits(enum usart usart, int bits)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	if (bits != 1)
 		r |= USART_CFG_STOPLEN;
@@ -78,7 +67,7 @@ void usart_set_parity(enum usart usart, enum usart_parity parity)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	if (parity == USART_EVEN) {
 		r |= USART_CFG_PARITYSEL1;
@@ -97,7 +86,7 @@ void usart_set_flow_control(enum usart usart,
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	if (flowcontrol != USART_FLOW_NONE)
 		r |= USART_CFG_CTSEN;
@@ -113,7 +102,7 @@ void usart_init(enum usart usart, int u_pclk, int baud, int databits,
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 
 	/* Baud rate */
 	USART_BRG(base) = (u_pclk / (16 * baud) - 1) & USART_BRG_MASK;
@@ -164,7 +153,7 @@ void usart_enable(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r |= USART_CFG_ENABLE;
 	USART_CFG(base) = r & USART_CFG_MASK;
@@ -175,7 +164,7 @@ void usart_disable(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r &= ~USART_CFG_ENABLE;
 	USART_CFG(base) = r & USART_CFG_MASK;
@@ -186,7 +175,7 @@ void usart_enable_sync_mode(enum usart usart, bool master, bool rising_edge)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r |= USART_CFG_SYNCEN | (master ? USART_CFG_SYNCMST : 0) |
 		(rising_edge ? USART_CFG_CLKPOL : 0);
@@ -198,48 +187,18 @@ void usart_disable_sync_mode(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r &= ~USART_CFG_SYNCEN;
 	USART_CFG(base) = r & USART_CFG_MASK;
 }
 
-void usart_send(enum usart usart, int data)
-{
-	USART_TXDAT(base_addr(usart)) = data & USART_TXDAT_MASK;
-}
-
-int usart_recv(enum usart usart)
-{
-	return USART_RXDAT(base_addr(usart)) & USART_RXDAT_MASK;
-}
-
-void usart_send_blocking(enum usart usart, int data)
-{
-	int base;
-
-	base = base_addr(usart);
-	while (!(USART_STAT(base) & USART_STAT_TXRDY))
-		;
-	USART_TXDAT(base) = data & USART_TXDAT_MASK;
-}
-
-int usart_recv_blocking(enum usart usart)
-{
-	int base;
-
-	base = base_addr(usart);
-	while (!(USART_STAT(base) & USART_STAT_RXRDY))
-		;
-	return USART_RXDAT(base) & USART_RXDAT_MASK;
-}
-
 void usart_enable_loopback(enum usart usart)
 {
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r |= USART_CFG_LOOP;
 	USART_CFG(base) = r & USART_CFG_MASK;
@@ -250,7 +209,7 @@ void usart_disable_loopback(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CFG(base);
 	r &= ~USART_CFG_LOOP;
 	USART_CFG(base) = r & USART_CFG_MASK;
@@ -261,7 +220,7 @@ void usart_enable_break(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r |= USART_CTL_TXBRKEN;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -272,7 +231,7 @@ void usart_disable_break(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r &= ~USART_CTL_TXBRKEN;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -283,7 +242,7 @@ void usart_enable_address_detect_mode(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r |= USART_CTL_ADDRDET;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -294,7 +253,7 @@ void usart_disable_address_detect_mode(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r &= ~USART_CTL_ADDRDET;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -305,7 +264,7 @@ void usart_disable_tx(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r |= USART_CTL_TXDIS;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -316,7 +275,7 @@ void usart_enable_tx(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r &= ~USART_CTL_TXDIS;
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -327,7 +286,7 @@ void usart_enable_continuous_clock(enum usart usart, bool auto_clear)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r |= USART_CTL_CC | (auto_clear ? USART_CTL_CLRCC : 0);
 	USART_CTL(base) = r & USART_CTL_MASK;
@@ -338,33 +297,106 @@ void usart_disable_continuous_clock(enum usart usart)
 	int base;
 	int r;
 
-	base = base_addr(usart);
+	base = usart_base_addr(usart);
 	r = USART_CTL(base);
 	r &= ~USART_CTL_CC;
 	USART_CTL(base) = r & USART_CTL_MASK;
 }
 
-void usart_enable_interrupt(enum usart usart, int interrupt)
+/*
+ * Interrupt-driven buffered I/O
+ *
+ * The application reads from the Rx ring and writes to the Tx ring;
+ * usart_buffered_isr() (called from uartN_isr()) fills the Rx ring and
+ * drains the Tx ring.  Each index is written by one side only, so no
+ * locking is needed.  The USART interrupt must be enabled in the NVIC.
+ */
+void usart_buffered_init(struct usart_buffered *ub, enum usart usart,
+			 u8 *rxbuf, int rxsize, u8 *txbuf, int txsize)
 {
-	USART_INTENSET(base_addr(usart)) = interrupt & USART_INTENSET_MASK;
+	ub->usart = usart;
+	ub->rx.buf = rxbuf;
+	ub->rx.size = rxsize;
+	ub->rx.head = 0;
+	ub->rx.tail = 0;
+	ub->tx.buf = txbuf;
+	ub->tx.size = txsize;
+	ub->tx.head = 0;
+	ub->tx.tail = 0;
+	ub->overrun = 0;
+
+	/* Tx interrupt is enabled while the Tx ring isn't empty. */
+	USART_INTENSET(usart_base_addr(usart)) = USART_INTENSET_RXRDYEN;
 }
 
-void usart_disable_interrupt(enum usart usart, int interrupt)
+/* Read up to size bytes.  Return the number of bytes read. */
+int usart_read(struct usart_buffered *ub, void *data, int size)
 {
-	USART_INTENCLR(base_addr(usart)) = interrupt & USART_INTENCLR_MASK;
+	u8 *p = data;
+	unsigned int head;
+	int n;
+
+	head = ub->rx.head;
+	for (n = 0; n < size && head != ub->rx.tail; n++) {
+		barrier();
+		*p++ = ub->rx.buf[head++ & (ub->rx.size - 1)];
+	}
+	barrier();
+	ub->rx.head = head;
+	return n;
 }
 
-int usart_get_interrupt_mask(enum usart usart, int interrupt)
+/* Write up to size bytes.  Return the number of bytes written. */
+int usart_write(struct usart_buffered *ub, const void *data, int size)
 {
-	return USART_INTENSET(base_addr(usart)) & interrupt;
+	const u8 *p = data;
+	unsigned int tail;
+	int n;
+
+	tail = ub->tx.tail;
+	for (n = 0; n < size && tail - ub->tx.head < ub->tx.size; n++)
+		ub->tx.buf[tail++ & (ub->tx.size - 1)] = *p++;
+	barrier();
+	ub->tx.tail = tail;
+
+	if (n)
+		USART_INTENSET(usart_base_addr(ub->usart)) =
+			USART_INTENSET_TXRDYEN;
+	return n;
 }
 
-int usart_get_interrupt_status(enum usart usart, int interrupt)
+void usart_buffered_isr(struct usart_buffered *ub)
 {
-	return USART_INTSTAT(base_addr(usart)) & interrupt;
-}
+	int base;
+	int s;
+	unsigned int i;
+
+	base = usart_base_addr(ub->usart);
+	s = USART_INTSTAT(base);
+
+	/* Rx */
+	while (s & USART_INTSTAT_RXRDY) {
+		i = ub->rx.tail;
+		if (i - ub->rx.head < ub->rx.size) {
+			ub->rx.buf[i & (ub->rx.size - 1)] = USART_RXDAT(base);
+			barrier();
+			ub->rx.tail = i + 1;
+		} else {
+			USART_RXDAT(base);
+			ub->overrun++;
+		}
+		s = USART_INTSTAT(base);
+	}
 
-void usart_clear_interrupt(enum usart usart, int interrupt)
-{
-	USART_STAT(base_addr(usart)) = interrupt & USART_STAT_MASK;
+	/* Tx */
+	if (s & USART_INTSTAT_TXRDY) {
+		i = ub->tx.head;
+		if (i != ub->tx.tail) {
+			USART_TXDAT(base) = ub->tx.buf[i & (ub->tx.size - 1)];
+			barrier();
+			ub->tx.head = i + 1;
+		} else {
+			USART_INTENCLR(base) = USART_INTENCLR_TXRDYCLR;
+		}
+	}
 }
@@ -46,26 +46,45 @@ extern void pinint5_isr(void)	__attribute__ ((weak, alias ("_dummy_isr")));
 extern void pinint6_isr(void)	__attribute__ ((weak, alias ("_dummy_isr")));
 extern void pinint7_isr(void)	__attribute__ ((weak, alias ("_dummy_isr")));
 
-void _reset(void)	__attribute__ ((naked, section (".startup")));
+/*
+ * early_init() is called before .data and .bss are set up, so it must not
+ * use (or call anything that uses) initialized or zeroed variables.  An
+ * application can raise the system clock and the flash access time there
+ * to shorten the rest of the startup.
+ */
+extern void early_init(void) __attribute__ ((weak, alias ("_dummy_init")));
+
+void _reset(void)	__attribute__ ((noreturn, section (".startup")));
 void _dummy_isr(void)	__attribute__ ((section (".startup")));
+void _dummy_init(void)	__attribute__ ((section (".startup")));
 
 void _reset(void)
 {
-	int i;
-	extern char _data_start[];
-	extern char _data_load_start[];
-	extern char _data_size[];
-	extern char _bss_start[];
-	extern char _bss_size[];
+	unsigned int *src;
+	unsigned int *dst;
+	extern unsigned int _ramfunc_start[];
+	extern unsigned int _ramfunc_end[];
+	extern unsigned int _ramfunc_load_start[];
+	extern unsigned int _data_start[];
+	extern unsigned int _data_end[];
+	extern unsigned int _data_load_start[];
+	extern unsigned int _bss_start[];
+	extern unsigned int _bss_end[];
 	extern int main(void);
 
-	/* Move initialized data (Flash) to RAM */
-	for (i = 0; i < (int)_data_size; i++)
-		_data_start[i] = _data_load_start[i];
+	early_init();
+
+	/* Move RAMFUNC code and initialized data (Flash) to RAM */
+	src = _ramfunc_load_start;
+	for (dst = _ramfunc_start; dst < _ramfunc_end; dst++)
+		*dst = *src++;
+	src = _data_load_start;
+	for (dst = _data_start; dst < _data_end; dst++)
+		*dst = *src++;
 
 	/* Clear BSS. */
-	for (i = 0; i < (int)_bss_size; i++)
-		_bss_start[i] = 0;
+	for (dst = _bss_start; dst < _bss_end; dst++)
+		*dst = 0;
 
 	/* Go to user application. */
 	main();
@@ -80,6 +99,10 @@ void _dummy_isr(void)
 		;
 }
 
+void _dummy_init(void)
+{
+}
+
 void (* const _vector[]) (void) __attribute__ ((section (".vector"))) = {
 	(void *)_stack,
 	_reset,
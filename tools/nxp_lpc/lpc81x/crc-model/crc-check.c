@@ -0,0 +1,174 @@
+/*
+ * crc-check.c - Check the CRC driver (crc.c) against crc_model.c
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The driver runs against the CRC engine of the host register model
+ * (liblpc81x-host.a).  For every CRC_MODE, crc_calc(), crc_calc16(),
+ * crc_calc32() and streaming contexts (interleaved with each other and
+ * with crc_calc()) are compared with the bit-serial model, at every
+ * alignment of the buffer.
+ */
+
+#include <stdio.h>
+
+#include <mmio_host.h>
+#include "crc_model.h"
+
+#define BUF_SIZE	1024
+
+static u8 buf[BUF_SIZE + 8] __attribute__ ((aligned (4)));
+
+static void fill(u8 *p, size_t len, u32 seed)
+{
+	u32 x = seed | 1;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		p[i] = x;
+	}
+}
+
+/* Sum of byte writes */
+static u32 model_sum(int mode, u32 seed, const u8 *p, size_t len)
+{
+	struct crc_model m;
+
+	crc_model_init(&m, mode, seed);
+	crc_model_update_bytewise(&m, p, len);
+	return crc_model_sum(&m);
+}
+
+/* Sum of len writes of size bytes (host byte order) */
+static u32 model_sum_words(int mode, u32 seed, const void *p, int len,
+			   int size)
+{
+	struct crc_model m;
+	int i;
+
+	crc_model_init(&m, mode, seed);
+	for (i = 0; i < len; i++) {
+		if (size == 2)
+			crc_model_write(&m, ((const u16 *)p)[i], 2);
+		else
+			crc_model_write(&m, ((const u32 *)p)[i], 4);
+	}
+	return crc_model_sum(&m);
+}
+
+static int check(int mode, int j)
+{
+	struct crc_context a;
+	struct crc_context b;
+	u32 seed;
+	u32 w;
+	int other;
+	int errors;
+	size_t off;
+	size_t len;
+	size_t half;
+
+	errors = 0;
+	seed = j * 0x9e3779b9;
+	off = j % 8;
+	len = j * 97 % (BUF_SIZE - 8);
+	half = len / 2 + j % 3;
+	if (half > len)
+		half = len;
+	other = (mode + 0x15) % 64;
+	if ((other & 3) == 3)
+		other--;
+
+	crc_set_mode(mode);
+	w = crc_calc(seed, (char *)buf + off, len);
+	if (w != model_sum(mode, seed, buf + off, len)) {
+		printf("mode 0x%02x: crc_calc() %zu bytes at +%zu\n",
+		       mode, len, off);
+		errors++;
+	}
+	w = crc_calc16(seed, (short *)buf, len / 2);
+	if (w != model_sum_words(mode, seed, buf, len / 2, 2)) {
+		printf("mode 0x%02x: crc_calc16() %zu\n", mode, len / 2);
+		errors++;
+	}
+	w = crc_calc32(seed, (int *)buf, len / 4);
+	if (w != model_sum_words(mode, seed, buf, len / 4, 4)) {
+		printf("mode 0x%02x: crc_calc32() %zu\n", mode, len / 4);
+		errors++;
+	}
+
+	/* Two contexts and crc_calc() take turns on the engine. */
+	crc_init(&a, mode, seed);
+	crc_init(&b, other, ~seed);
+	crc_update(&a, buf + off, half);
+	crc_update(&b, buf, len);
+	w = crc_calc(seed, (char *)buf, len);
+	if (w != model_sum(mode, seed, buf, len)) {
+		printf("mode 0x%02x: crc_calc() between updates\n", mode);
+		errors++;
+	}
+	if ((u32)crc_final(&a) != model_sum(mode, seed, buf + off, half)) {
+		printf("mode 0x%02x: crc_final() after %zu bytes at +%zu\n",
+		       mode, half, off);
+		errors++;
+	}
+	crc_update(&a, buf + off + half, len - half);
+	if ((u32)crc_final(&a) != model_sum(mode, seed, buf + off, len)) {
+		printf("mode 0x%02x: crc_update() %zu + %zu bytes at +%zu\n",
+		       mode, half, len - half, off);
+		errors++;
+	}
+	if ((u32)crc_final(&b) != model_sum(other, ~seed, buf, len)) {
+		printf("mode 0x%02x: second context\n", other);
+		errors++;
+	}
+
+	return errors;
+}
+
+int main(void)
+{
+	int errors;
+	int modes;
+	int mode;
+	int j;
+
+	mmio_host_reset();
+	fill(buf, sizeof(buf), 1);
+
+	/* CRC-32 of "123456789" through the driver */
+	errors = 0;
+	crc_set_mode(CRC_32 | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM | CRC_CMPL_SUM);
+	if ((u32)crc_calc(0xffffffff, "123456789", 9) != 0xcbf43926) {
+		printf("CRC-32: crc_calc()\n");
+		errors++;
+	}
+	modes = 0;
+	for (mode = 0; mode < 64; mode++) {
+		if ((mode & 3) == 3)
+			continue;
+		modes++;
+		for (j = 0; j < 24; j++)
+			errors += check(mode, j);
+	}
+	printf("%d modes: %s\n", modes, errors ? "failed" : "passed");
+	return errors != 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * crc-model.c - CRC_SUM of files, self-test and benchmark of crc_model.c
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc_model.h"
+
+/* The CRC-32 of Ethernet and zlib */
+#define DEFAULT_MODE	(CRC_32 | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM | \
+			 CRC_CMPL_SUM)
+#define DEFAULT_SEED	0xffffffff
+
+#define SECTOR_SIZE	1024
+#define TEST_SIZE	(1024 * 1024)
+#define BENCH_SIZE	(64 * 1024 * 1024)
+
+/* Catalogue values for "123456789" */
+static const struct {
+	const char *name;
+	int mode;
+	u32 seed;
+	u32 sum;
+} check_table[] = {
+	{"CRC-32", DEFAULT_MODE, 0xffffffff, 0xcbf43926},
+	{"CRC-32/MPEG-2", CRC_32, 0xffffffff, 0x0376e6e7},
+	{"CRC-16/ARC", CRC_16 | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM, 0, 0xbb3d},
+	{"CRC-16/KERMIT", CRC_CCITT | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM, 0,
+	 0x2189},
+	{"CRC-16/XMODEM", CRC_CCITT, 0, 0x31c3}
+};
+
+static const char *poly_name[3] = {"CRC-CCITT", "CRC-16", "CRC-32"};
+
+/* Deterministic data (xorshift) */
+static void fill(u8 *buf, size_t len, u32 seed)
+{
+	u32 x = seed | 1;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u32 sum_of(int mode, u32 seed, const u8 *buf, size_t len,
+		  bool bytewise)
+{
+	struct crc_model m;
+
+	crc_model_init(&m, mode, seed);
+	if (bytewise)
+		crc_model_update_bytewise(&m, buf, len);
+	else
+		crc_model_update(&m, buf, len);
+	return crc_model_sum(&m);
+}
+
+static int self_test(int threads)
+{
+	struct crc_model a;
+	struct crc_model b;
+	u8 *buf;
+	u32 seed;
+	u32 w;
+	int errors;
+	int mode;
+	int i;
+	int j;
+	size_t off;
+	size_t len;
+
+	errors = 0;
+	for (i = 0; i < (int)(sizeof(check_table) / sizeof(check_table[0]));
+	     i++) {
+		w = sum_of(check_table[i].mode, check_table[i].seed,
+			   (const u8 *)"123456789", 9, false);
+		if (w != check_table[i].sum) {
+			printf("%s: 0x%08x (0x%08x)\n", check_table[i].name,
+			       w, check_table[i].sum);
+			errors++;
+		}
+	}
+
+	buf = malloc(TEST_SIZE);
+	if (buf == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fill(buf, TEST_SIZE, 1);
+
+	/* Every CRC_MODE: tables, word writes and combine */
+	for (mode = 0; mode < 64; mode++) {
+		if ((mode & 3) == 3)
+			continue;
+		for (j = 0; j < 32; j++) {
+			seed = j * 0x9e3779b9;
+			off = j * 7 % 64;
+			len = j * 97 % 2048;
+			if (sum_of(mode, seed, buf + off, len, false) !=
+			    sum_of(mode, seed, buf + off, len, true)) {
+				printf("mode 0x%02x: table %zu bytes\n",
+				       mode, len);
+				errors++;
+			}
+
+			/* A word write equals 4 byte writes (MSB first). */
+			crc_model_init(&a, mode, seed);
+			crc_model_init(&b, mode, seed);
+			w = buf[off] << 24 | buf[off + 1] << 16 |
+				buf[off + 2] << 8 | buf[off + 3];
+			crc_model_write(&a, w, 4);
+			crc_model_update_bytewise(&b, buf + off, 4);
+			if (a.state != b.state) {
+				printf("mode 0x%02x: word write\n", mode);
+				errors++;
+			}
+
+			crc_model_init(&a, mode, seed);
+			crc_model_update(&a, buf, off + len / 2);
+			crc_model_init(&b, mode, 0);
+			crc_model_update(&b, buf + off + len / 2,
+					 len - len / 2);
+			crc_model_combine(&a, &b, len - len / 2);
+			if (crc_model_sum(&a) !=
+			    sum_of(mode, seed, buf, off + len, false)) {
+				printf("mode 0x%02x: combine\n", mode);
+				errors++;
+			}
+		}
+		if (crc_model_calc(mode, 0x12345678, buf, TEST_SIZE - 3,
+				   threads) !=
+		    sum_of(mode, 0x12345678, buf, TEST_SIZE - 3, false)) {
+			printf("mode 0x%02x: %d threads\n", mode, threads);
+			errors++;
+		}
+	}
+	free(buf);
+	printf("%s\n", errors ? "failed" : "passed");
+	return errors;
+}
+
+static int bench(int threads)
+{
+	static const int mode_table[3] = {
+		CRC_CCITT | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM,
+		CRC_16 | CRC_BIT_RVS_WR | CRC_BIT_RVS_SUM,
+		DEFAULT_MODE
+	};
+	u8 *buf;
+	double t;
+	double mb;
+	int p;
+
+	buf = malloc(BENCH_SIZE);
+	if (buf == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fill(buf, BENCH_SIZE, 2);
+	mb = BENCH_SIZE / 1e6;
+
+	printf("%-10s %12s %12s %12s\n", "", "bit-serial", "slicing-8",
+	       "threads");
+	for (p = 0; p < 3; p++) {
+		printf("%-10s", poly_name[p]);
+		t = now();
+		sum_of(mode_table[p], 0, buf, BENCH_SIZE / 64, true);
+		printf(" %7.1f MB/s", mb / 64 / (now() - t));
+		t = now();
+		sum_of(mode_table[p], 0, buf, BENCH_SIZE, false);
+		printf(" %7.1f MB/s", mb / (now() - t));
+		t = now();
+		crc_model_calc(mode_table[p], 0, buf, BENCH_SIZE, threads);
+		printf(" %7.1f MB/s\n", mb / (now() - t));
+	}
+	printf("(%d threads)\n", threads);
+	free(buf);
+	return 0;
+}
+
+static int file_sum(char *fname, int mode, u32 seed, int threads,
+		    bool sectors)
+{
+	FILE *fp;
+	u8 *buf;
+	long len;
+	long i;
+	int r;
+
+	fp = fopen(fname, "rb");
+	if (fp == NULL) {
+		perror(fname);
+		return -1;
+	}
+	r = -1;
+	buf = NULL;
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET)) {
+		perror(fname);
+		goto out;
+	}
+	buf = malloc(len ? len : 1);
+	if (buf == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	if (fread(buf, 1, len, fp) != (size_t)len) {
+		fprintf(stderr, "%s: read error\n", fname);
+		goto out;
+	}
+
+	if (sectors) {
+		for (i = 0; i < len; i += SECTOR_SIZE)
+			printf("%s %ld 0x%08x\n", fname, i / SECTOR_SIZE,
+			       sum_of(mode, seed, buf + i,
+				      len - i < SECTOR_SIZE ? len - i :
+				      SECTOR_SIZE, false));
+	} else {
+		printf("%s 0x%08x\n", fname,
+		       crc_model_calc(mode, seed, buf, len, threads));
+	}
+	r = 0;
+out:
+	free(buf);
+	fclose(fp);
+	return r;
+}
+
+static void usage(char *prog)
+{
+	printf("Usage: %s [options] [file ...]\n", prog);
+	printf("  -h\t\tPrint this message\n");
+	printf("  -m <mode>\tCRC_MODE value (default 0x%02x: CRC-32)\n",
+	       DEFAULT_MODE);
+	printf("  -s <seed>\tCRC_SEED value (default 0x%08x)\n",
+	       DEFAULT_SEED);
+	printf("  -j <n>\tNumber of threads\n");
+	printf("  -S\t\tPrint the CRC_SUM of each 1 KB sector\n");
+	printf("  -t\t\tSelf-test\n");
+	printf("  -b\t\tBenchmark\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int mode = DEFAULT_MODE;
+	u32 seed = DEFAULT_SEED;
+	int threads;
+	bool sectors = false;
+	bool test = false;
+	bool benchmark = false;
+	int r;
+	int i;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+
+	while ((opt = getopt(argc, argv, "bhj:m:s:St")) != -1) {
+		switch (opt) {
+		case 'b':
+			benchmark = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(0);
+		case 'j':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		case 'm':
+			mode = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			sectors = true;
+			break;
+		case 't':
+			test = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	if ((mode & ~0x3f) || (mode & 3) == 3) {
+		fprintf(stderr, "invalid mode: 0x%x\n", mode);
+		exit(1);
+	}
+
+	if (test)
+		return self_test(threads) ? 1 : 0;
+	if (benchmark)
+		return bench(threads) ? 1 : 0;
+
+	r = 0;
+	for (i = optind; i < argc; i++) {
+		if (file_sum(argv[i], mode, seed, threads, sectors))
+			r = 1;
+	}
+	return r;
+}
@@ -0,0 +1,342 @@
+/*
+ * Host model of the LPC81x CRC engine
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#include "crc_model.h"
+
+#define MAX_THREADS	64
+
+/* Below this a thread is not worth starting. */
+#define MIN_PART	(64 * 1024)
+
+/* CRC-CCITT, CRC-16, CRC-32 */
+static const u32 poly_table[3] = {0x1021, 0x8005, 0x04c11db7};
+
+/*
+ * [poly][reflected][slice][byte]
+ * reflected (BIT_RVS_WR): the state is bit reversed and right aligned.
+ * otherwise: the state is left aligned (bit 31 is the feedback bit).
+ */
+static u32 table[3][2][8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+struct part {
+	struct crc_model m;
+	const u8 *buf;
+	size_t len;
+	pthread_t thread;
+	int started;
+};
+
+static int poly_index(int mode)
+{
+	int i = mode & 3;
+
+	return i < 3 ? i : 2;		/* 3: reserved, as CRC-32 */
+}
+
+static int width(int mode)
+{
+	return poly_index(mode) == 2 ? 32 : 16;
+}
+
+static u32 mask(int mode)
+{
+	return width(mode) == 32 ? 0xffffffff : 0xffff;
+}
+
+static u32 bitreverse(u32 v, int bits)
+{
+	u32 r;
+	int i;
+
+	r = 0;
+	for (i = 0; i < bits; i++) {
+		r = r << 1 | (v & 1);
+		v >>= 1;
+	}
+	return r;
+}
+
+static void make_table(void)
+{
+	u32 poly;
+	u32 rpoly;
+	u32 c;
+	int w;
+	int p;
+	int i;
+	int j;
+	int k;
+
+	for (p = 0; p < 3; p++) {
+		w = p == 2 ? 32 : 16;
+		poly = poly_table[p] << (32 - w);
+		rpoly = bitreverse(poly_table[p], w);
+		for (i = 0; i < 256; i++) {
+			c = i << 24;
+			for (j = 0; j < 8; j++)
+				c = c & 0x80000000 ? c << 1 ^ poly : c << 1;
+			table[p][0][0][i] = c;
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = c & 1 ? c >> 1 ^ rpoly : c >> 1;
+			table[p][1][0][i] = c;
+		}
+		for (k = 1; k < 8; k++) {
+			for (i = 0; i < 256; i++) {
+				c = table[p][0][k - 1][i];
+				table[p][0][k][i] = c << 8 ^
+					table[p][0][0][c >> 24];
+				c = table[p][1][k - 1][i];
+				table[p][1][k][i] = c >> 8 ^
+					table[p][1][0][c & 0xff];
+			}
+		}
+	}
+}
+
+void crc_model_init(struct crc_model *m, int mode, u32 seed)
+{
+	pthread_once(&table_once, make_table);
+	m->mode = mode;
+	m->state = seed & mask(mode);
+}
+
+/* One write to CRC_WR_DATA (size 4), CRC_WR_DATA16 (2) or CRC_WR_DATA8 (1) */
+void crc_model_write(struct crc_model *m, u32 data, int size)
+{
+	u32 poly;
+	u32 top;
+	u32 s;
+	u32 r;
+	int bits;
+	int i;
+
+	bits = size * 8;
+	if (bits < 32)
+		data &= (1U << bits) - 1;
+	if (m->mode & CRC_CMPL_WR)
+		data = ~data & (bits < 32 ? (1U << bits) - 1 : 0xffffffff);
+	if (m->mode & CRC_BIT_RVS_WR) {
+		r = 0;
+		for (i = 0; i < bits; i += 8)
+			r |= bitreverse(data >> i & 0xff, 8) << i;
+		data = r;
+	}
+
+	poly = poly_table[poly_index(m->mode)];
+	top = 1U << (width(m->mode) - 1);
+	s = m->state;
+	for (i = bits - 1; i >= 0; i--) {
+		if (!(s & top) != !(data >> i & 1))
+			s = (s << 1 ^ poly) & mask(m->mode);
+		else
+			s = s << 1 & mask(m->mode);
+	}
+	m->state = s;
+}
+
+static u32 le32(const u8 *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static u32 be32(const u8 *p)
+{
+	return (u32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static u32 update_reflected(u32 (*t)[256], u32 c, const u8 *p, size_t len,
+			    u32 cmpl)
+{
+	u32 one;
+	u32 two;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		one = (le32(p) ^ cmpl) ^ c;
+		two = le32(p + 4) ^ cmpl;
+		c = t[7][one & 0xff] ^ t[6][one >> 8 & 0xff] ^
+			t[5][one >> 16 & 0xff] ^ t[4][one >> 24] ^
+			t[3][two & 0xff] ^ t[2][two >> 8 & 0xff] ^
+			t[1][two >> 16 & 0xff] ^ t[0][two >> 24];
+	}
+	for (; len; len--)
+		c = t[0][(c ^ *p++ ^ cmpl) & 0xff] ^ c >> 8;
+	return c;
+}
+
+static u32 update_normal(u32 (*t)[256], u32 c, const u8 *p, size_t len,
+			 u32 cmpl)
+{
+	u32 one;
+	u32 two;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		one = (be32(p) ^ cmpl) ^ c;
+		two = be32(p + 4) ^ cmpl;
+		c = t[7][one >> 24] ^ t[6][one >> 16 & 0xff] ^
+			t[5][one >> 8 & 0xff] ^ t[4][one & 0xff] ^
+			t[3][two >> 24] ^ t[2][two >> 16 & 0xff] ^
+			t[1][two >> 8 & 0xff] ^ t[0][two & 0xff];
+	}
+	for (; len; len--)
+		c = t[0][(c >> 24 ^ *p++ ^ cmpl) & 0xff] ^ c << 8;
+	return c;
+}
+
+/* Same as a CRC_WR_DATA8 write of each byte */
+void crc_model_update(struct crc_model *m, const void *buf, size_t len)
+{
+	u32 (*t)[256];
+	u32 cmpl;
+	int w;
+
+	w = width(m->mode);
+	cmpl = m->mode & CRC_CMPL_WR ? 0xffffffff : 0;
+	if (m->mode & CRC_BIT_RVS_WR) {
+		t = table[poly_index(m->mode)][1];
+		m->state = bitreverse(update_reflected(t,
+			bitreverse(m->state, w), buf, len, cmpl), w);
+	} else {
+		t = table[poly_index(m->mode)][0];
+		m->state = update_normal(t, m->state << (32 - w), buf, len,
+					 cmpl) >> (32 - w);
+	}
+}
+
+/* Bit-serial (the reference of crc_model_update()) */
+void crc_model_update_bytewise(struct crc_model *m, const void *buf,
+			       size_t len)
+{
+	const u8 *p = buf;
+
+	while (len--)
+		crc_model_write(m, *p++, 1);
+}
+
+/* CRC_SUM */
+u32 crc_model_sum(const struct crc_model *m)
+{
+	u32 v;
+
+	v = m->state;
+	if (m->mode & CRC_BIT_RVS_SUM)
+		v = bitreverse(v, width(m->mode));
+	if (m->mode & CRC_CMPL_SUM)
+		v = ~v;
+	return v & mask(m->mode);
+}
+
+/* a * b mod P */
+static u32 mulmod(int mode, u32 a, u32 b)
+{
+	u32 poly;
+	u32 top;
+	u32 r;
+	int i;
+
+	poly = poly_table[poly_index(mode)];
+	top = 1U << (width(mode) - 1);
+	r = 0;
+	for (i = width(mode) - 1; i >= 0; i--) {
+		r = (r & top ? r << 1 ^ poly : r << 1) & mask(mode);
+		if (a >> i & 1)
+			r ^= b;
+	}
+	return r;
+}
+
+/* x^(8 * len) mod P */
+static u32 xpow8n(int mode, size_t len)
+{
+	unsigned long long n;
+	u32 r;
+	u32 sq;
+
+	r = 1;
+	sq = 2;
+	for (n = (unsigned long long)len * 8; n; n >>= 1) {
+		if (n & 1)
+			r = mulmod(mode, r, sq);
+		sq = mulmod(mode, sq, sq);
+	}
+	return r;
+}
+
+/*
+ * a becomes the state after its own data and then the len_b bytes of b
+ * (b started with seed 0 in the same mode).
+ */
+void crc_model_combine(struct crc_model *a, const struct crc_model *b,
+		       size_t len_b)
+{
+	a->state = mulmod(a->mode, a->state, xpow8n(a->mode, len_b)) ^
+		b->state;
+}
+
+static void *part_thread(void *arg)
+{
+	struct part *p = arg;
+
+	crc_model_update(&p->m, p->buf, p->len);
+	return NULL;
+}
+
+/* CRC_SUM of buf with up to threads threads */
+u32 crc_model_calc(int mode, u32 seed, const void *buf, size_t len,
+		   int threads)
+{
+	struct part part[MAX_THREADS];
+	const u8 *p = buf;
+	size_t size;
+	int n;
+	int i;
+
+	n = threads;
+	if (n > MAX_THREADS)
+		n = MAX_THREADS;
+	if ((size_t)n > len / MIN_PART)
+		n = len / MIN_PART;
+	if (n <= 1) {
+		crc_model_init(&part[0].m, mode, seed);
+		crc_model_update(&part[0].m, buf, len);
+		return crc_model_sum(&part[0].m);
+	}
+
+	size = len / n;
+	for (i = 0; i < n; i++) {
+		crc_model_init(&part[i].m, mode, i ? 0 : seed);
+		part[i].buf = p + size * i;
+		part[i].len = i < n - 1 ? size : len - size * i;
+		part[i].started = !pthread_create(&part[i].thread, NULL,
+						 part_thread, &part[i]);
+		if (!part[i].started)
+			part_thread(&part[i]);
+	}
+	for (i = 0; i < n; i++) {
+		if (part[i].started)
+			pthread_join(part[i].thread, NULL);
+		if (i)
+			crc_model_combine(&part[0].m, &part[i].m,
+					  part[i].len);
+	}
+	return crc_model_sum(&part[0].m);
+}
@@ -0,0 +1,55 @@
+/*
+ * Host model of the LPC81x CRC engine
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The mode is a CRC_MODE value (<crc.h>) and the state is kept in the
+ * CRC_SEED form, so a sum computed here is the CRC_SUM the engine would
+ * return for the same seed and data.
+ *
+ * crc_model_write() is the bit-serial reference of a CRC_WR_DATA,
+ * CRC_WR_DATA16 or CRC_WR_DATA8 write.  crc_model_update() gives the
+ * same result as byte writes with slicing-by-8 tables, and
+ * crc_model_calc() splits a large buffer between threads and joins the
+ * parts with crc_model_combine().
+ */
+
+#ifndef CRC_MODEL_H
+#define CRC_MODEL_H
+
+#include <stddef.h>
+
+#include <crc.h>
+
+struct crc_model {
+	int mode;
+	u32 state;		/* CRC_SEED form */
+};
+
+void crc_model_init(struct crc_model *m, int mode, u32 seed);
+void crc_model_write(struct crc_model *m, u32 data, int size);
+void crc_model_update(struct crc_model *m, const void *buf, size_t len);
+void crc_model_update_bytewise(struct crc_model *m, const void *buf,
+			       size_t len);
+u32 crc_model_sum(const struct crc_model *m);
+void crc_model_combine(struct crc_model *a, const struct crc_model *b,
+		       size_t len_b);
+u32 crc_model_calc(int mode, u32 seed, const void *buf, size_t len,
+		   int threads);
+
+#endif
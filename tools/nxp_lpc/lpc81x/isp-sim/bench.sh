@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# bench.sh - Measure usart-util download/upload time with isp-sim
+#
+# Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+#
+# This file is part of usart-util.
+#
+# usart-util is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# usart-util is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Environment:
+#   USART_UTIL	usart-util to measure (default: ../usart-util/usart-util)
+#   FLAGS	extra usart-util options (e.g. "-c -i")
+#   SIM_FLAGS	extra isp-sim options (e.g. "-t 2000")
+
+SIM=./isp-sim
+USART_UTIL=${USART_UTIL:-../usart-util/usart-util}
+DIR=$(mktemp -d) || exit 1
+TTY=$DIR/tty
+SIM_PID=
+
+cleanup()
+{
+	[ -n "$SIM_PID" ] && kill $SIM_PID 2>/dev/null
+	rm -rf $DIR
+}
+trap cleanup EXIT INT TERM
+
+now()
+{
+	date +%s.%N
+}
+
+# run <label> <usart-util options>
+run()
+{
+	label=$1
+	shift
+	t0=$(now)
+	if ! $USART_UTIL -d $TTY $FLAGS "$@" >$DIR/log 2>&1; then
+		cat $DIR/log
+		echo "$label: FAILED"
+		exit 1
+	fi
+	t1=$(now)
+	awk -v l="$label" -v t0=$t0 -v t1=$t1 -v n=$bytes \
+	    'BEGIN { printf "%-10s %6d bytes %8.3f s %8.1f KB/s\n",
+		     l, n, t1 - t0, n / 1024 / (t1 - t0) }'
+}
+
+echo "usart-util $FLAGS / isp-sim $SIM_FLAGS"
+for part in 4:0x8100 8:0x8110 16:0x8120; do
+	kb=${part%%:*}
+	pid=${part#*:}
+	bytes=$((kb * 1024))
+	image=$DIR/image$kb.bin
+
+	# The stub doesn't run on the LPC810 (see the README).
+	case "$FLAGS" in
+	*-L*)
+		[ $pid = 0x8100 ] && continue
+		;;
+	esac
+
+	# Fixed pseudo-random contents
+	LC_ALL=C awk -v n=$bytes 'BEGIN { srand(1); for (i = 0; i < n; i++)
+				 printf "%c", int(rand() * 256) }' >$image
+
+	$SIM -l $TTY -p $pid $SIM_FLAGS >/dev/null &
+	SIM_PID=$!
+	i=0
+	while [ ! -e $TTY ]; do
+		i=$((i + 1))
+		if [ $i -gt 50 ]; then
+			echo "isp-sim didn't start"
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	echo "${kb}K (part ID $pid)"
+	run download -D $image
+	run reflash -D $image
+	run upload -U $DIR/upload.bin -t $bytes
+
+	# The checksum in the vector table (offset 28) is set on download.
+	if ! cmp -s -i 32 $image $DIR/upload.bin; then
+		echo "upload: data differ"
+		exit 1
+	fi
+
+	kill $SIM_PID
+	wait $SIM_PID 2>/dev/null
+	SIM_PID=
+	rm -f $TTY
+done
@@ -0,0 +1,1112 @@
+/*
+ * isp-sim.c - LPC81x UART ISP simulator
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The simulator opens a pseudo-terminal and speaks the boot ROM ISP
+ * protocol on its master side.  usart-util is pointed at the slave side
+ * (or at the symlink given with -l).
+ *
+ * The modeled line rate (-b) and flash timing (-e, -w) are applied as
+ * delays, so the elapsed time of a transfer is comparable to a real part.
+ * A '?' at the start of a command line resets the simulated part and
+ * restarts auto-baud, so usart-util can be run repeatedly against one
+ * instance.  The flash contents survive the reset.
+ *
+ * As on the part, input that arrives while a command runs (before its
+ * return code has been sent) is lost, and 'B' accepts only the rates of
+ * the boot ROM (9600 to 115200).
+ *
+ * 'G' to the entry of the flash stub (usart-util -L) runs a model of the
+ * stub (../usart-util/stub/stub.h) instead: the body is received, and
+ * the frames are answered until a '?' between two frames resets the part.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+
+#include "stub.h"
+
+#define FLASH_ADDRESS	0x00000000
+#define SRAM_ADDRESS	0x10000000
+#define RESERVE_SIZE	0x00000300
+#define PAGE_SIZE	64
+#define SECTOR_SIZE	1024
+
+#define UNLOCK_CODE	23130
+
+/* UART ISP Return Codes */
+#define CMD_SUCCESS			0
+#define INVALID_COMMAND			1
+#define SRC_ADDR_ERROR			2
+#define DST_ADDR_ERROR			3
+#define SRC_ADDR_NOT_MAPPED		4
+#define DST_ADDR_NOT_MAPPED		5
+#define COUNT_ERROR			6
+#define INVALID_SECTOR			7
+#define SECTOR_NOT_BLANK		8
+#define SECTOR_NOT_PREPARED		9
+#define COMPARE_ERROR			10
+#define PARAM_ERROR			12
+#define ADDR_ERROR			13
+#define ADDR_NOT_MAPPED			14
+#define CMD_LOCKED			15
+#define INVALID_CODE			16
+#define INVALID_BAUD_RATE		17
+#define INVALID_STOP_BIT		18
+
+static struct {
+	uint32_t pid;
+	int flash;
+	int sram;
+} device_table[] = {
+	{0x8100, 4096, 1024},
+	{0x8110, 8192, 2048},
+	{0x8120, 16384, 4096},
+	{0x8121, 16384, 4096},
+	{0x8122, 16384, 4096},
+	{0, 0, 0}
+};
+
+static bool debug;
+static int mfd;
+
+static uint32_t pid = 0x8100;
+static int flash_size;
+static int sram_size;
+static uint8_t flash[16384];
+static uint8_t sram[4096];
+static uint32_t uid[4] = {0x12345678, 0x9abcdef0, 0x0f1e2d3c, 0x4b5a6978};
+
+static int init_baud = 115200;	/* modeled line rate (0: no delay) */
+static int erase_time = 100000;	/* us per erase command */
+static int write_time = 1000;	/* us per 64-byte page */
+static int latency;		/* us per input burst (adapter turnaround) */
+
+static int baud;
+static bool running;		/* a command is running */
+static bool echo;
+static bool unlocked;
+static uint32_t prepared;
+static uint32_t go_addr;
+static struct timespec line;	/* time the line becomes idle */
+
+static uint8_t rxbuf[4096];
+static int rxhead;
+static int rxtail;
+
+/* Rates the boot ROM accepts for 'B' */
+static const int rate_table[] = {
+	9600, 19200, 38400, 57600, 115200, 0
+};
+
+static void usage(char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -h\t\tPrint this message\n");
+	printf("  -v\t\tPrint the received commands\n");
+	printf("  -l <link>\tCreate a symbolic link to the slave device\n");
+	printf("  -p <pid>\tSpecify part ID (default: 0x8100)\n");
+	printf("  -b <baud>\tSpecify line rate, 0 for none "
+	       "(default: 115200)\n");
+	printf("  -e <us>\tSpecify erase time (default: 100000)\n");
+	printf("  -w <us>\tSpecify page write time (default: 1000)\n");
+	printf("  -t <us>\tSpecify adapter turnaround latency "
+	       "(default: 0)\n");
+	printf("  -i <file>\tLoad initial flash contents from file\n");
+}
+
+static void timespec_add(struct timespec *t, long us)
+{
+	t->tv_sec += us / 1000000;
+	t->tv_nsec += (us % 1000000) * 1000;
+	if (t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+}
+
+/* Occupy the line (or the part) for a while. */
+static void busy(long us)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (line.tv_sec < now.tv_sec ||
+	    (line.tv_sec == now.tv_sec && line.tv_nsec < now.tv_nsec))
+		line = now;
+	timespec_add(&line, us);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &line, NULL) ==
+	       EINTR)
+		;
+}
+
+/* Time to transfer bytes (10 bits per character) */
+static long line_time(int bytes)
+{
+	if (baud == 0)
+		return 0;
+	return (long)bytes * 10000000 / baud;
+}
+
+/*
+ * The USART has no receive FIFO and the ROM doesn't read the line while
+ * it runs a command, so the input that arrives before the return code
+ * has been sent is lost.
+ */
+static void discard_input(void)
+{
+	struct pollfd pfd;
+	int n;
+	int r;
+
+	n = rxtail - rxhead;
+	rxhead = 0;
+	rxtail = 0;
+	pfd.fd = mfd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) == 1) {
+		r = read(mfd, rxbuf, sizeof(rxbuf));
+		if (r <= 0)
+			break;
+		n += r;
+	}
+	if (n)
+		fprintf(stderr, "Overrun: %d bytes lost\n", n);
+}
+
+static void send_data(const void *s, int size)
+{
+	const uint8_t *p = s;
+	int r;
+
+	busy(line_time(size));
+	if (running) {
+		discard_input();
+		running = false;
+	}
+	while (size > 0) {
+		r = write(mfd, p, size);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("write() failed");
+			exit(1);
+		}
+		p += r;
+		size -= r;
+	}
+}
+
+static void send_line(const char *fmt, ...)
+	__attribute__ ((format (printf, 1, 2)));
+
+static void send_line(const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf) - 2, fmt, ap);
+	va_end(ap);
+	strcpy(&buf[n], "\r\n");
+	send_data(buf, n + 2);
+}
+
+static int get_byte(void)
+{
+	struct pollfd pfd;
+	bool waited;
+	int r;
+
+	if (rxhead == rxtail) {
+		/*
+		 * Input that had to be waited for pays the adapter
+		 * turnaround.  Input that arrived while the part was busy
+		 * is already there.
+		 */
+		pfd.fd = mfd;
+		pfd.events = POLLIN;
+		waited = poll(&pfd, 1, 0) != 1;
+		do {
+			r = read(mfd, rxbuf, sizeof(rxbuf));
+		} while (r < 0 && (errno == EINTR || errno == EIO));
+		if (r <= 0) {
+			perror("read() failed");
+			exit(1);
+		}
+		rxhead = 0;
+		rxtail = r;
+		if (waited)
+			busy(latency);
+		busy(line_time(r));
+	}
+	r = rxbuf[rxhead++];
+	if (echo)
+		send_data(&rxbuf[rxhead - 1], 1);
+	return r;
+}
+
+static void reset(void)
+{
+	echo = true;
+	unlocked = false;
+	prepared = 0;
+	baud = init_baud;
+	memset(sram, 0, sizeof(sram));
+}
+
+/* Auto-baud: wait for '?' and "Synchronized" */
+static void isp_sync(bool got_question)
+{
+	char buf[32];
+	int c;
+	int i;
+
+	for (;;) {
+		while (!got_question) {
+			echo = false;
+			if (get_byte() == '?')
+				got_question = true;
+		}
+		reset();
+		send_line("Synchronized");
+		got_question = false;
+
+		for (i = 0; i < sizeof(buf) - 1; i++) {
+			c = get_byte();
+			if (c == '\n')
+				break;
+			buf[i] = c;
+		}
+		buf[i] = '\0';
+		if (strcmp(buf, "Synchronized\r"))
+			continue;
+		send_line("OK");
+
+		for (i = 0; i < sizeof(buf) - 1; i++) {
+			c = get_byte();
+			if (c == '\n')
+				break;
+			buf[i] = c;
+		}
+		buf[i] = '\0';
+		send_line("OK");
+		if (debug)
+			printf("Synchronized (%s)\n", buf);
+		return;
+	}
+}
+
+static uint8_t *map(uint32_t addr, int bytes, bool writable)
+{
+	if (!writable && addr + bytes <= FLASH_ADDRESS + flash_size)
+		return &flash[addr - FLASH_ADDRESS];
+	if (addr >= SRAM_ADDRESS && addr + bytes <= SRAM_ADDRESS + sram_size)
+		return &sram[addr - SRAM_ADDRESS];
+	return NULL;
+}
+
+static int check_sectors(int start, int end)
+{
+	if (start < 0 || end >= flash_size / SECTOR_SIZE)
+		return INVALID_SECTOR;
+	if (end < start)
+		return PARAM_ERROR;
+	return CMD_SUCCESS;
+}
+
+static uint32_t crc32(const uint8_t *p, int bytes)
+{
+	uint32_t crc;
+	int i;
+
+	crc = 0xffffffff;
+	while (bytes--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+	}
+	return ~crc;
+}
+
+static void com_write_ram(uint32_t addr, int bytes)
+{
+	uint8_t *p;
+	int i;
+
+	p = map(addr, bytes, true);
+	if (addr & 3) {
+		send_line("%d", ADDR_ERROR);
+		return;
+	}
+	if (bytes & 3) {
+		send_line("%d", COUNT_ERROR);
+		return;
+	}
+	if (p == NULL || addr < SRAM_ADDRESS + RESERVE_SIZE) {
+		send_line("%d", ADDR_NOT_MAPPED);
+		return;
+	}
+	send_line("%d", CMD_SUCCESS);
+	for (i = 0; i < bytes; i++)
+		p[i] = get_byte();
+}
+
+static void com_read_memory(uint32_t addr, int bytes)
+{
+	uint8_t *p;
+
+	p = map(addr, bytes, false);
+	if (addr & 3) {
+		send_line("%d", ADDR_ERROR);
+		return;
+	}
+	if (bytes & 3) {
+		send_line("%d", COUNT_ERROR);
+		return;
+	}
+	if (p == NULL) {
+		send_line("%d", ADDR_NOT_MAPPED);
+		return;
+	}
+	send_line("%d", CMD_SUCCESS);
+	send_data(p, bytes);
+}
+
+static void com_copy(uint32_t dst, uint32_t src, int bytes)
+{
+	uint8_t *s;
+	uint32_t mask;
+	int i;
+
+	if (!unlocked) {
+		send_line("%d", CMD_LOCKED);
+		return;
+	}
+	if (bytes != 64 && bytes != 128 && bytes != 256 && bytes != 512 &&
+	    bytes != 1024) {
+		send_line("%d", COUNT_ERROR);
+		return;
+	}
+	if (dst % PAGE_SIZE) {
+		send_line("%d", DST_ADDR_ERROR);
+		return;
+	}
+	if (dst + bytes > FLASH_ADDRESS + flash_size) {
+		send_line("%d", DST_ADDR_NOT_MAPPED);
+		return;
+	}
+	if (src & 3) {
+		send_line("%d", SRC_ADDR_ERROR);
+		return;
+	}
+	s = map(src, bytes, true);
+	if (s == NULL) {
+		send_line("%d", SRC_ADDR_NOT_MAPPED);
+		return;
+	}
+	mask = 0;
+	for (i = dst / SECTOR_SIZE; i <= (dst + bytes - 1) / SECTOR_SIZE; i++)
+		mask |= 1 << i;
+	if ((prepared & mask) != mask) {
+		send_line("%d", SECTOR_NOT_PREPARED);
+		return;
+	}
+	for (i = 0; i < bytes; i++)
+		flash[dst + i] &= s[i];
+	prepared = 0;
+	busy((long)write_time * (bytes / PAGE_SIZE));
+	send_line("%d", CMD_SUCCESS);
+}
+
+static void com_erase(int start, int end)
+{
+	uint32_t mask;
+	int r;
+	int i;
+
+	if (!unlocked) {
+		send_line("%d", CMD_LOCKED);
+		return;
+	}
+	r = check_sectors(start, end);
+	if (r) {
+		send_line("%d", r);
+		return;
+	}
+	mask = 0;
+	for (i = start; i <= end; i++)
+		mask |= 1 << i;
+	if ((prepared & mask) != mask) {
+		send_line("%d", SECTOR_NOT_PREPARED);
+		return;
+	}
+	memset(&flash[start * SECTOR_SIZE], 0xff,
+	       (end - start + 1) * SECTOR_SIZE);
+	prepared = 0;
+	busy(erase_time);
+	send_line("%d", CMD_SUCCESS);
+}
+
+static void com_blank_check(int start, int end)
+{
+	int r;
+	int i;
+
+	r = check_sectors(start, end);
+	if (r) {
+		send_line("%d", r);
+		return;
+	}
+	for (i = start * SECTOR_SIZE; i < (end + 1) * SECTOR_SIZE; i += 4) {
+		if (flash[i] != 0xff || flash[i + 1] != 0xff ||
+		    flash[i + 2] != 0xff || flash[i + 3] != 0xff) {
+			send_line("%d", SECTOR_NOT_BLANK);
+			send_line("%d", i - start * SECTOR_SIZE);
+			send_line("%u", flash[i] | flash[i + 1] << 8 |
+				  flash[i + 2] << 16 |
+				  (uint32_t)flash[i + 3] << 24);
+			return;
+		}
+	}
+	send_line("%d", CMD_SUCCESS);
+}
+
+static void com_compare(uint32_t addr1, uint32_t addr2, int bytes)
+{
+	uint8_t *p1;
+	uint8_t *p2;
+	int i;
+
+	if ((addr1 | addr2) & 3) {
+		send_line("%d", ADDR_ERROR);
+		return;
+	}
+	if (bytes & 3) {
+		send_line("%d", COUNT_ERROR);
+		return;
+	}
+	p1 = map(addr1, bytes, false);
+	p2 = map(addr2, bytes, false);
+	if (p1 == NULL || p2 == NULL) {
+		send_line("%d", ADDR_NOT_MAPPED);
+		return;
+	}
+	for (i = 0; i < bytes; i += 4) {
+		if (memcmp(&p1[i], &p2[i], 4)) {
+			send_line("%d", COMPARE_ERROR);
+			send_line("%d", i);
+			return;
+		}
+	}
+	send_line("%d", CMD_SUCCESS);
+}
+
+static void com_read_crc(uint32_t addr, int bytes)
+{
+	uint8_t *p;
+
+	if (addr & 3) {
+		send_line("%d", ADDR_ERROR);
+		return;
+	}
+	if (bytes & 3) {
+		send_line("%d", COUNT_ERROR);
+		return;
+	}
+	p = map(addr, bytes, false);
+	if (p == NULL) {
+		send_line("%d", ADDR_NOT_MAPPED);
+		return;
+	}
+	send_line("%d", CMD_SUCCESS);
+	send_line("%u", crc32(p, bytes));
+}
+
+static void com_set_baud_rate(int rate, int stop)
+{
+	int i;
+
+	for (i = 0; rate_table[i] && rate_table[i] != rate; i++)
+		;
+	if (!rate_table[i]) {
+		send_line("%d", INVALID_BAUD_RATE);
+		return;
+	}
+	if (stop != 1 && stop != 2) {
+		send_line("%d", INVALID_STOP_BIT);
+		return;
+	}
+	send_line("%d", CMD_SUCCESS);
+	if (init_baud)
+		baud = rate;
+}
+
+/* Execute one command line.  Return true on 'G'. */
+static bool command(char *buf)
+{
+	unsigned int a1;
+	unsigned int a2;
+	int n;
+	char c;
+	int i;
+
+	if (debug)
+		printf("%s\n", buf);
+
+	switch (buf[0]) {
+	case 'U':
+		if (sscanf(buf, "U %u", &a1) != 1) {
+			send_line("%d", PARAM_ERROR);
+		} else if (a1 != UNLOCK_CODE) {
+			send_line("%d", INVALID_CODE);
+		} else {
+			unlocked = true;
+			send_line("%d", CMD_SUCCESS);
+		}
+		break;
+	case 'B':
+		if (sscanf(buf, "B %u %d", &a1, &n) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_set_baud_rate(a1, n);
+		break;
+	case 'A':
+		if (sscanf(buf, "A %d", &n) != 1 || (n != 0 && n != 1)) {
+			send_line("%d", PARAM_ERROR);
+		} else {
+			send_line("%d", CMD_SUCCESS);
+			echo = n;
+		}
+		break;
+	case 'W':
+		if (sscanf(buf, "W %u %d", &a1, &n) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_write_ram(a1, n);
+		break;
+	case 'R':
+		if (sscanf(buf, "R %u %d", &a1, &n) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_read_memory(a1, n);
+		break;
+	case 'P':
+		if (sscanf(buf, "P %u %u", &a1, &a2) != 2) {
+			send_line("%d", PARAM_ERROR);
+		} else if ((n = check_sectors(a1, a2))) {
+			send_line("%d", n);
+		} else {
+			for (i = a1; i <= a2; i++)
+				prepared |= 1 << i;
+			send_line("%d", CMD_SUCCESS);
+		}
+		break;
+	case 'C':
+		if (sscanf(buf, "C %u %u %d", &a1, &a2, &n) != 3)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_copy(a1, a2, n);
+		break;
+	case 'G':
+		if (sscanf(buf, "G %u %c", &a1, &c) != 2 || c != 'T') {
+			send_line("%d", PARAM_ERROR);
+		} else if (!unlocked) {
+			send_line("%d", CMD_LOCKED);
+		} else {
+			send_line("%d", CMD_SUCCESS);
+			go_addr = a1;
+			return true;
+		}
+		break;
+	case 'E':
+		if (sscanf(buf, "E %u %u", &a1, &a2) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_erase(a1, a2);
+		break;
+	case 'I':
+		if (sscanf(buf, "I %u %u", &a1, &a2) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_blank_check(a1, a2);
+		break;
+	case 'J':
+		send_line("%d", CMD_SUCCESS);
+		send_line("%u", pid);
+		break;
+	case 'K':
+		send_line("%d", CMD_SUCCESS);
+		send_line("%d", 4);
+		send_line("%d", 13);
+		break;
+	case 'M':
+		if (sscanf(buf, "M %u %u %d", &a1, &a2, &n) != 3)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_compare(a1, a2, n);
+		break;
+	case 'N':
+		send_line("%d", CMD_SUCCESS);
+		for (i = 0; i < 4; i++)
+			send_line("%u", uid[i]);
+		break;
+	case 'S':
+		if (sscanf(buf, "S %u %d", &a1, &n) != 2)
+			send_line("%d", PARAM_ERROR);
+		else
+			com_read_crc(a1, n);
+		break;
+	default:
+		send_line("%d", INVALID_COMMAND);
+		break;
+	}
+	return false;
+}
+
+/* Flash stub */
+static struct {
+	uint8_t *buf;		/* window buffer */
+	int window;
+	int count;		/* bytes decoded */
+	bool bad;		/* a frame of the window was lost */
+	int last_seq;
+} stub;
+
+static uint16_t crc_ccitt(const uint8_t *p, int n)
+{
+	uint16_t crc;
+	int i;
+
+	crc = 0xffff;
+	while (n--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = crc << 1 ^ (crc & 0x8000 ? 0x1021 : 0);
+	}
+	return crc;
+}
+
+static uint32_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | get16(p + 2) << 16;
+}
+
+static void stub_reply(int type, int status, int seq)
+{
+	uint8_t buf[4];
+
+	buf[0] = STUB_SOF;
+	buf[1] = type;
+	buf[2] = status;
+	buf[3] = seq;
+	send_data(buf, 4);
+}
+
+static void stub_put(int c)
+{
+	if (stub.count < stub.window)
+		stub.buf[stub.count++] = c;
+	else
+		stub.bad = true;
+}
+
+static void stub_decode(const uint8_t *p, int len)
+{
+	int n;
+	int d;
+
+	if (get16(p) == 0) {
+		stub.count = 0;
+		stub.bad = false;
+	} else if (get16(p) != stub.count) {
+		stub.bad = true;
+	}
+	p += 2;
+	len -= 2;
+	while (len-- > 0) {
+		if (*p < 0x80) {
+			for (n = *p++ + 1; n > 0 && len > 0; n--, len--)
+				stub_put(*p++);
+			continue;
+		}
+		if (len < 2) {
+			stub.bad = true;
+			return;
+		}
+		n = *p - 0x80 + STUB_MATCH_MIN;
+		d = get16(p + 1);
+		p += 3;
+		len -= 2;
+		if (d == 0 || d > stub.count) {
+			stub.bad = true;
+			continue;
+		}
+		while (n-- > 0)
+			stub_put(stub.buf[stub.count - d]);
+	}
+}
+
+/* A blank range is not erased again. */
+static int stub_erase(int start, int end)
+{
+	int r;
+	int i;
+
+	r = check_sectors(start, end);
+	if (r)
+		return r;
+	for (i = start * SECTOR_SIZE; i < (end + 1) * SECTOR_SIZE; i++) {
+		if (flash[i] != 0xff)
+			break;
+	}
+	if (i == (end + 1) * SECTOR_SIZE)
+		return CMD_SUCCESS;
+	memset(&flash[start * SECTOR_SIZE], 0xff,
+	       (end - start + 1) * SECTOR_SIZE);
+	busy(erase_time);
+	return CMD_SUCCESS;
+}
+
+static int stub_commit(const uint8_t *p)
+{
+	uint32_t addr;
+	uint32_t crc;
+	int n;
+	int i;
+
+	addr = get32(&p[0]);
+	n = get16(&p[4]);
+	crc = get32(&p[8]);
+	if (stub.bad || n != stub.count)
+		return STUB_BAD_FRAME;
+	if (crc32(stub.buf, n) != crc)
+		return STUB_BAD_DATA;
+	if (n % PAGE_SIZE || addr % PAGE_SIZE)
+		return STUB_INVALID;
+	if (addr + n > FLASH_ADDRESS + flash_size)
+		return DST_ADDR_NOT_MAPPED;
+	for (i = 0; i < n; i++)
+		flash[addr - FLASH_ADDRESS + i] &= stub.buf[i];
+	busy((long)write_time * (n / PAGE_SIZE));
+	if (crc32(&flash[addr - FLASH_ADDRESS], n) != crc)
+		return STUB_VERIFY_ERROR;
+	return CMD_SUCCESS;
+}
+
+/* Execute one frame (type, length, payload). */
+static void stub_frame(uint8_t *frame)
+{
+	uint8_t *p = &frame[2];
+	uint8_t *q;
+	uint8_t d[4];
+	uint32_t crc;
+	int type = frame[0];
+	int r;
+
+	if (debug && type != STUB_DATA)
+		printf("Stub %c\n", type);
+
+	switch (type) {
+	case STUB_DATA:
+		if (frame[1] < 2 || stub.buf == NULL)
+			stub.bad = true;
+		else
+			stub_decode(p, frame[1]);
+		break;
+	case STUB_SETUP:
+		stub.buf = map(get32(&p[4]), get16(&p[8]), true);
+		stub.window = get16(&p[8]);
+		stub.count = 0;
+		stub_reply(type, stub.buf ? CMD_SUCCESS : STUB_INVALID, 0);
+		if (stub.buf && init_baud)
+			baud = (long long)STUB_CLOCK * 256 /
+				(16 * (get16(&p[0]) + 1) * (256 + p[2]));
+		break;
+	case STUB_ERASE:
+		stub_reply(type, stub_erase(p[0], p[1]), 0);
+		break;
+	case STUB_COMMIT:
+		/* The reply of the last window was lost. */
+		if (p[6] == stub.last_seq) {
+			r = CMD_SUCCESS;
+		} else {
+			r = stub.buf ? stub_commit(p) : STUB_BAD_FRAME;
+			if (r == CMD_SUCCESS)
+				stub.last_seq = p[6];
+		}
+		stub.count = 0;
+		stub.bad = false;
+		stub_reply(type, r, p[6]);
+		break;
+	case STUB_VERIFY:
+	case STUB_READ:
+		q = map(get32(&p[0]), get16(&p[4]), false);
+		if (q == NULL) {
+			stub_reply(type, SRC_ADDR_NOT_MAPPED, 0);
+			break;
+		}
+		stub_reply(type, CMD_SUCCESS, 0);
+		if (type == STUB_READ) {
+			send_data(q, get16(&p[4]));
+			break;
+		}
+		crc = crc32(q, get16(&p[4]));
+		d[0] = crc;
+		d[1] = crc >> 8;
+		d[2] = crc >> 16;
+		d[3] = crc >> 24;
+		send_data(d, 4);
+		break;
+	default:
+		stub_reply(type, STUB_INVALID, 0);
+		break;
+	}
+}
+
+/* Run the stub until a '?' between two frames (reset). */
+static void run_stub(void)
+{
+	uint8_t frame[2 + STUB_PAYLOAD_MAX];
+	uint32_t size;
+	uint16_t crc;
+	int c;
+	int i;
+
+	size = get32(&sram[STUB_LOADER - SRAM_ADDRESS]);
+	if (debug)
+		printf("Stub loader (body %u bytes)\n", size);
+	echo = false;
+	for (i = 0; i < size && i < STUB_LOADER - SRAM_ADDRESS; i++)
+		sram[i] = get_byte();
+	memset(&stub, 0, sizeof(stub));
+	stub.last_seq = -1;
+	stub_reply(STUB_HELLO, CMD_SUCCESS, STUB_VERSION);
+
+	for (;;) {
+		c = get_byte();
+		if (c == '?')
+			return;
+		if (c != STUB_SOF)
+			continue;
+		frame[0] = get_byte();
+		frame[1] = get_byte();
+		for (i = 0; i < frame[1]; i++)
+			frame[2 + i] = get_byte();
+		crc = get_byte() << 8;
+		crc |= get_byte();
+		if (crc != crc_ccitt(frame, 2 + frame[1])) {
+			if (debug)
+				printf("Stub: CRC error (%c)\n", frame[0]);
+			stub.bad = true;
+			continue;
+		}
+		stub_frame(frame);
+	}
+}
+
+static void run(void)
+{
+	char buf[64];
+	bool r;
+	int c;
+	int i;
+
+	isp_sync(false);
+	for (;;) {
+		i = 0;
+		for (;;) {
+			c = get_byte();
+			if (i == 0 && c == '?') {
+				/* Reset and auto-baud */
+				isp_sync(true);
+				continue;
+			}
+			if (c == '\n')
+				break;
+			if (i < sizeof(buf) - 1)
+				buf[i++] = c;
+		}
+		if (i > 0 && buf[i - 1] == '\r')
+			i--;
+		buf[i] = '\0';
+		if (i == 0)
+			continue;
+
+		running = true;
+		r = command(buf);
+		running = false;
+		if (r) {
+			if (go_addr == STUB_ENTRY) {
+				run_stub();
+				isp_sync(true);
+				continue;
+			}
+			/* User code runs until the next reset. */
+			if (debug)
+				printf("Running\n");
+			isp_sync(false);
+		}
+	}
+}
+
+static int load_flash(char *fname)
+{
+	FILE *stream;
+
+	stream = fopen(fname, "r");
+	if (stream == NULL) {
+		perror(fname);
+		return -1;
+	}
+	fread(flash, 1, flash_size, stream);
+	if (ferror(stream)) {
+		fprintf(stderr, "File read error\n");
+		fclose(stream);
+		return -1;
+	}
+	fclose(stream);
+	return 0;
+}
+
+static char *linkname;
+
+static void cleanup(int sig)
+{
+	if (linkname)
+		unlink(linkname);
+	_exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int i;
+	char *fname = NULL;
+	char *slave;
+	int sfd;
+	struct termios tio;
+
+	while ((opt = getopt(argc, argv, "b:e:hi:l:p:t:vw:")) != -1) {
+		switch (opt) {
+		case 'b':
+			init_baud = atoi(optarg);
+			break;
+		case 'e':
+			erase_time = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'i':
+			fname = optarg;
+			break;
+		case 'l':
+			linkname = optarg;
+			break;
+		case 'p':
+			pid = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			latency = atoi(optarg);
+			break;
+		case 'v':
+			debug = true;
+			break;
+		case 'w':
+			write_time = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; device_table[i].pid; i++) {
+		if (device_table[i].pid == pid)
+			break;
+	}
+	if (!device_table[i].pid) {
+		fprintf(stderr, "Invalid part ID (0x%x).\n", pid);
+		return 1;
+	}
+	flash_size = device_table[i].flash;
+	sram_size = device_table[i].sram;
+	memset(flash, 0xff, sizeof(flash));
+	if (fname && load_flash(fname))
+		return 1;
+
+	/* Open pseudo-terminal. */
+	mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (mfd < 0 || grantpt(mfd) || unlockpt(mfd)) {
+		perror("posix_openpt() failed");
+		return 1;
+	}
+	slave = ptsname(mfd);
+
+	/*
+	 * Keep the slave side open so that the master doesn't see a hangup
+	 * between two sessions.
+	 */
+	sfd = open(slave, O_RDWR | O_NOCTTY);
+	if (sfd < 0) {
+		perror(slave);
+		return 1;
+	}
+	tcgetattr(sfd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(sfd, TCSANOW, &tio);
+
+	if (linkname) {
+		unlink(linkname);
+		if (symlink(slave, linkname)) {
+			perror(linkname);
+			return 1;
+		}
+		signal(SIGINT, cleanup);
+		signal(SIGTERM, cleanup);
+	}
+	printf("%s\n", slave);
+	fflush(stdout);
+
+	run();
+	return 0;
+}
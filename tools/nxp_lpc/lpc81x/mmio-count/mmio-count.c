@@ -0,0 +1,310 @@
+/*
+ * mmio-count.c - Register accesses of the driver API calls
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The setup and main loop sequences of the examples are run against the
+ * register model of liblpc81x-count.a.  The loads and stores of each
+ * library function are printed, written to a baseline file (-o) or
+ * compared with one (-c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mmio_count.h>
+#include <syscon.h>
+#include <gpio.h>
+#include <usart.h>
+#include <spi.h>
+#include <sct.h>
+#include <mrt.h>
+#include <nvic.h>
+
+#define U_PCLK		22118400
+#define LOOPS		10
+
+#define MAX_BASELINE	512
+
+struct baseline {
+	char function[64];
+	unsigned long calls;
+	unsigned long loads;
+	unsigned long stores;
+};
+
+static u8 rxbuf[32];
+static u8 txbuf[32];
+
+/* usart, sct_pwm, mrt and spi_barometer */
+static void setup(void)
+{
+	syscon_enable_pll(SYSCON_IRC, 2, 4);
+	syscon_set_system_clock(SYSCON_PLL_OUT, 1);
+	syscon_set_usart_clock(24000000, U_PCLK);
+
+	syscon_enable_clock(SYSCON_IOCON);
+	gpio_config(GPIO_OUTPUT, GPIO_IO, PIO0_10 | PIO0_11);
+	gpio_clear(PIO0_10 | PIO0_11);
+	gpio_config(GPIO_OUTPUT, 0, PIO0_2);
+	gpio_config(GPIO_U0_TXD, GPIO_HYST, PIO0_4);
+	gpio_config(GPIO_CTIN0, GPIO_HYST, PIO0_3);
+
+	syscon_enable_clock(SYSCON_UART0);
+	usart_init(USART0, U_PCLK, 115200, 8, 1, USART_PARITY_NONE,
+		   USART_FLOW_NONE);
+
+	syscon_enable_clock(SYSCON_SCT);
+	sct_config(SCT_CLOCK_BUS, 0, SCT_UNIFY | SCT_AUTOLIMIT);
+	sct_set_match_and_reload(0, 24000000 / 100 - 1);
+	sct_set_match_and_reload(1, 0);
+	sct_setup_event(0, 1, 0, SCT_STATE0 | SCT_MATCH_ONLY,
+			SCT_EV_OUT0_SET, 0);
+	sct_setup_event(2, 0, 0, SCT_STATE0 | SCT_IO_ONLY | SCT_FALL,
+			SCT_EV_STATE_ADD, 1);
+	sct_start_counter();
+
+	syscon_enable_clock(SYSCON_MRT);
+	nvic_enable_irq(NVIC_MRT);
+	mrt_set_mode(MRT0, MRT_REPEAT);
+	mrt_enable_interrupt(MRT_INT0);
+	mrt_set_mode(MRT1, MRT_ONE_SHOT);
+
+	syscon_enable_clock(SYSCON_SPI0);
+	spi_init_master(SPI0, SPI_MODE0, 3, 0, 0, 0, 0);
+	spi_enable_interrupt(SPI0, SPI_RXRDY);
+}
+
+static void loop(void)
+{
+	struct usart_buffered ub;
+	u8 buf[8];
+	int i;
+
+	usart_buffered_init(&ub, USART1, rxbuf, sizeof(rxbuf),
+			    txbuf, sizeof(txbuf));
+	for (i = 0; i < LOOPS; i++) {
+		gpio_toggle(PIO0_2);
+		usart_send_blocking(USART0, '0' + i);
+
+		sct_set_match_reload(1, 24000000 / 100 / 256 * i);
+
+		mrt_set_interval(MRT1, 24000000 / 1000);
+		mrt_get_channel_status(MRT1, MRT_INT);
+		mrt_clear_channel_status(MRT1, MRT_INT);
+
+		spi_send_blocking(SPI0, i);
+		spi_recv_blocking(SPI0);
+
+		usart_write(&ub, "ab", 2);
+		mmio_host_usart_input(USART1, (const u8 *)"cd", 2);
+		usart_buffered_isr(&ub);
+		usart_buffered_isr(&ub);
+		usart_read(&ub, buf, sizeof(buf));
+	}
+}
+
+static void print_functions(void)
+{
+	const struct mmio_count *c;
+	int n;
+	int i;
+
+	n = mmio_count_functions(&c);
+	printf("%-32s %6s %8s %8s %10s\n", "function", "calls", "loads",
+	       "stores", "per call");
+	for (i = 0; i < n; i++) {
+		if (c[i].loads + c[i].stores == 0)
+			continue;
+		printf("%-32s %6lu %8lu %8lu %10.1f\n", c[i].function,
+		       c[i].calls, c[i].loads, c[i].stores,
+		       (double)(c[i].loads + c[i].stores) / c[i].calls);
+	}
+}
+
+static void print_sites(void)
+{
+	const struct mmio_count *c;
+	char s[64];
+	int n;
+	int i;
+
+	n = mmio_count_sites(&c);
+	printf("\n%-20s %-32s %8s %8s\n", "site", "in", "loads", "stores");
+	for (i = 0; i < n; i++) {
+		snprintf(s, sizeof(s), "%s:%d", c[i].file, c[i].line);
+		printf("%-20s %-32s %8lu %8lu\n", s, c[i].function,
+		       c[i].loads, c[i].stores);
+	}
+}
+
+static int write_baseline(char *fname)
+{
+	const struct mmio_count *c;
+	FILE *fp;
+	int n;
+	int i;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		perror(fname);
+		return -1;
+	}
+	fprintf(fp, "# function calls loads stores\n");
+	n = mmio_count_functions(&c);
+	for (i = 0; i < n; i++) {
+		if (c[i].loads + c[i].stores == 0)
+			continue;
+		fprintf(fp, "%s %lu %lu %lu\n", c[i].function, c[i].calls,
+			c[i].loads, c[i].stores);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int read_baseline(char *fname, struct baseline *b)
+{
+	FILE *fp;
+	char line[128];
+	int n;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		perror(fname);
+		return -1;
+	}
+	n = 0;
+	while (n < MAX_BASELINE && fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %lu %lu %lu", b[n].function,
+			   &b[n].calls, &b[n].loads, &b[n].stores) == 4)
+			n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+/* Return the number of functions with more accesses than the baseline. */
+static int check_baseline(char *fname)
+{
+	static struct baseline b[MAX_BASELINE];
+	const struct mmio_count *c;
+	int nb;
+	int n;
+	int i;
+	int j;
+	int r;
+
+	nb = read_baseline(fname, b);
+	if (nb < 0)
+		return -1;
+
+	r = 0;
+	n = mmio_count_functions(&c);
+	for (i = 0; i < n; i++) {
+		if (c[i].loads + c[i].stores == 0)
+			continue;
+		for (j = 0; j < nb; j++) {
+			if (!strcmp(b[j].function, c[i].function))
+				break;
+		}
+		if (j == nb) {
+			printf("new: %s %lu/%lu\n", c[i].function,
+			       c[i].loads, c[i].stores);
+			continue;
+		}
+		if (c[i].loads > b[j].loads || c[i].stores > b[j].stores) {
+			printf("regression: %s loads %lu -> %lu, "
+			       "stores %lu -> %lu\n", c[i].function,
+			       b[j].loads, c[i].loads, b[j].stores,
+			       c[i].stores);
+			r++;
+		} else if (c[i].loads < b[j].loads ||
+			   c[i].stores < b[j].stores) {
+			printf("improved: %s loads %lu -> %lu, "
+			       "stores %lu -> %lu\n", c[i].function,
+			       b[j].loads, c[i].loads, b[j].stores,
+			       c[i].stores);
+		}
+	}
+	return r;
+}
+
+static void usage(char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -h\t\tPrint this message\n");
+	printf("  -s\t\tPrint the accesses of each call site\n");
+	printf("  -o <file>\tWrite the baseline file\n");
+	printf("  -c <file>\tCompare with the baseline file\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	bool sites = false;
+	char *out = NULL;
+	char *base = NULL;
+	int r;
+
+	while ((opt = getopt(argc, argv, "c:ho:s")) != -1) {
+		switch (opt) {
+		case 'c':
+			base = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(0);
+		case 'o':
+			out = optarg;
+			break;
+		case 's':
+			sites = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	mmio_host_reset();
+	setup();
+	loop();
+
+	if (out)
+		return write_baseline(out) ? 1 : 0;
+	if (base) {
+		r = check_baseline(base);
+		if (r < 0)
+			return 1;
+		if (r) {
+			fprintf(stderr, "%d function(s) regressed\n", r);
+			return 1;
+		}
+		printf("no regression\n");
+		return 0;
+	}
+
+	print_functions();
+	if (sites)
+		print_sites();
+	return 0;
+}
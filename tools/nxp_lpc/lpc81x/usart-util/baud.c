@@ -0,0 +1,135 @@
+/*
+ * baud.c - Host line speed and baud rate negotiation
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * struct termios2 (<asm/termbits.h>) can't be used together with
+ * <termios.h>, so the line speed is set in this file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+#include "command.h"
+#include "baud.h"
+
+extern bool debug;
+
+/* The rates 'B' accepts (UM10601), fastest first */
+static int rate_table[] = {
+	115200, 57600, 38400, 19200, 9600, 0
+};
+
+/* Set any (also non-standard) line speed. */
+int set_line_speed(struct port *port, int baud)
+{
+	struct termios2 tio;
+
+	if (ioctl(port->fd, TCGETS2, &tio)) {
+		error_message(port, "TCGETS2 failed: %s\n",
+			      strerror(errno));
+		return -1;
+	}
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_ospeed = baud;
+	tio.c_ispeed = baud;
+	/* Wait until the output has been transmitted. */
+	if (ioctl(port->fd, TCSETSW2, &tio)) {
+		error_message(port, "TCSETSW2 failed: %s\n",
+			      strerror(errno));
+		return -1;
+	}
+	port->baud = baud;
+	return 0;
+}
+
+/* Check the link at the current rate. */
+static int probe(struct port *port)
+{
+	uint8_t version[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		flush_input(port);
+		if (!read_boot_code_version(port, version))
+			return 0;
+	}
+	return -1;
+}
+
+/* Switch both ends to rate.  Return 1 if the device rejects it. */
+static int switch_rate(struct port *port, int rate)
+{
+	char s[16];
+	int r;
+
+	sprintf(s, "%d", rate);
+	r = set_baud_rate(port, s, 1);
+	if (r == RESULT_INVALID_BAUD_RATE)
+		return 1;
+	if (r)
+		return -1;
+
+	if (set_line_speed(port, rate))
+		return -1;
+	usleep(10000);
+
+	return 0;
+}
+
+/*
+ * Switch to the fastest rate up to max that both ends accept.
+ * Return the new rate, or -1 if the link is lost after a switch.
+ *
+ * There is no fallback: after "B" has been answered the device runs at
+ * the new rate, can't be told to go back, and doesn't autobaud again
+ * without a reset, which usart-util can't do (no DTR/RTS control).
+ */
+int negotiate_baud_rate(struct port *port, int baud, int max)
+{
+	int i;
+	int r;
+
+	for (i = 0; rate_table[i] > baud; i++) {
+		if (rate_table[i] > max)
+			continue;
+		if (debug)
+			message(port, "Try %d baud\n", rate_table[i]);
+		r = switch_rate(port, rate_table[i]);
+		if (r < 0)
+			return -1;
+		if (r > 0)
+			continue;	/* rejected by the device */
+		if (!probe(port))
+			return rate_table[i];
+		error_message(port, "no response at %d baud (reset the device "
+			      "and use a lower -B)\n", rate_table[i]);
+		return -1;
+	}
+
+	return baud;
+}
@@ -20,104 +20,257 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <termios.h>
 
 #include "command.h"
+#include "trace.h"
 
 extern bool debug;
 
-uint32_t offset;
-uint32_t contents;
+/*
+ * The port is non-blocking.  Every transfer gets a deadline sized by its
+ * byte count at the current line speed, plus LINK_LATENCY and the time
+ * the device is busy (port->busy).  It starts when the data written so
+ * far has left the line (port->drain), and poll() waits for it.
+ */
+static long long now_ms(void)
+{
+	struct timespec ts;
 
-static bool echo_disable;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-static int com_write(int fd, char *s, int size)
+/* Time to transfer bytes at the line speed (10 bits per character) */
+static long long line_time(struct port *port, int bytes)
 {
-	int i;
-	int r;
-	char d;
+	return ((long long)bytes * 10000 + port->baud - 1) / port->baud;
+}
 
-	if (echo_disable) {
-		if (write(fd, s, size) < 0) {
-			perror("write() failed");
-			return -1;
-		}
-	} else {
-		for (i = 0; i < size; i++) {
-			r = write(fd, s, 1);
-			if (r < 0) {
-				perror("write() failed");
-				return -1;
-			}
+/* Start a transfer of bytes. */
+static void set_deadline(struct port *port, int bytes)
+{
+	long long t;
 
-			/* Wait for echo */
-			r = read(fd, &d, 1);
-			if (r < 0) {
-				perror("read() failed");
-				return -1;
-			}
-			if (r != 1)
-				return ERROR_TIMEOUT;
-			if (d != *s)
-				return ERROR_INVALID_VALUE;
+	t = now_ms();
+	if (t < port->drain)
+		t = port->drain;
+	port->deadline = t + LINK_LATENCY + port->busy + line_time(port, bytes);
+	port->busy = 0;
+}
 
-			s++;
-		}
-	}
+/* Wait for events until the deadline.  Return 0 on timeout. */
+static int wait_port(struct port *port, short events)
+{
+	struct pollfd pfd;
+	long long t;
+	int r;
 
-	return 0;
+	pfd.fd = port->fd;
+	pfd.events = events;
+	do {
+		t = port->deadline - now_ms();
+		if (t < 0)
+			t = 0;
+		r = poll(&pfd, 1, t);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		error_message(port, "poll() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return r;
 }
 
-static int com_puts(int fd, char *s)
+/* Fill the receive buffer.  Return 0 on timeout. */
+static int com_fill(struct port *port)
 {
-	return com_write(fd, s, strlen(s));
+	int i;
+	int n;
+	int r;
+
+	i = port->rx.tail & (RXBUF_SIZE - 1);
+	n = RXBUF_SIZE - (port->rx.tail - port->rx.head);
+	if (n > RXBUF_SIZE - i)
+		n = RXBUF_SIZE - i;
+
+	do {
+		r = wait_port(port, POLLIN);
+		if (r <= 0)
+			return r;
+		r = read(port->fd, &port->rx.buf[i], n);
+	} while (r < 0 && (errno == EAGAIN || errno == EINTR));
+	if (r < 0) {
+		error_message(port, "read() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (r == 0) {
+		error_message(port, "read() failed: end of file\n");
+		return -1;
+	}
+	port->rx.tail += r;
+	trace_io(port, 0, r);
+	return r;
 }
 
-static int com_read(int fd, char *s, int size)
+int com_read(struct port *port, char *s, int size)
 {
 	int i;
+	int n;
 	int r;
 
-	for (i = 0; i < size; i++) {
-		r = read(fd, s, 1);
-		if (r < 0) {
-			perror("read() failed");
-			return -1;
+	set_deadline(port, size);
+	while (size > 0) {
+		if (port->rx.head == port->rx.tail) {
+			r = com_fill(port);
+			if (r < 0)
+				return r;
+			if (r == 0)
+				return ERROR_TIMEOUT;
 		}
-		if (r != 1)
-			return ERROR_TIMEOUT;
 
-		s++;
+		i = port->rx.head & (RXBUF_SIZE - 1);
+		n = port->rx.tail - port->rx.head;
+		if (n > RXBUF_SIZE - i)
+			n = RXBUF_SIZE - i;
+		if (n > size)
+			n = size;
+		memcpy(s, &port->rx.buf[i], n);
+		port->rx.head += n;
+		s += n;
+		size -= n;
 	}
 	return 0;
 }
 
-static int com_gets(int fd, char *s, int size)
+int com_write(struct port *port, char *s, int size)
 {
 	int i;
+	int n;
 	int r;
+	long long t;
+	char d[256];
 
-	for (i = 0; i < size - 1; i++) {
-		r = read(fd, s, 1);
+	set_deadline(port, size);
+	for (i = 0; i < size; i += r) {
+		r = wait_port(port, POLLOUT);
+		if (r < 0)
+			return r;
+		if (r == 0)
+			return ERROR_TIMEOUT;
+		r = write(port->fd, s + i, size - i);
 		if (r < 0) {
-			perror("read() failed");
+			if (errno == EAGAIN || errno == EINTR) {
+				r = 0;
+				continue;
+			}
+			error_message(port, "write() failed: %s\n",
+				      strerror(errno));
 			return -1;
 		}
-		if (r != 1)
-			return ERROR_TIMEOUT;
+	}
+	t = now_ms();
+	if (port->drain < t)
+		port->drain = t;
+	port->drain += line_time(port, size);
+	trace_io(port, size, 0);
 
-		if (*s++ == '\n') {
-			*s = '\0';
-			return 0;
+	if (port->echo_disable)
+		return 0;
+
+	/* Verify echo */
+	for (i = 0; i < size; i += n) {
+		n = (size - i) > sizeof(d) ? sizeof(d) : size - i;
+		r = com_read(port, d, n);
+		if (r)
+			return r;
+		if (memcmp(d, s + i, n))
+			return ERROR_INVALID_VALUE;
+	}
+
+	return 0;
+}
+
+static int com_puts(struct port *port, char *s)
+{
+	return com_write(port, s, strlen(s));
+}
+
+static int com_gets(struct port *port, char *s, int size)
+{
+	int i;
+	int r;
+	char c;
+
+	set_deadline(port, size);
+	i = 0;
+	while (i < size - 1) {
+		if (port->rx.head == port->rx.tail) {
+			r = com_fill(port);
+			if (r < 0)
+				return r;
+			if (r == 0)
+				return ERROR_TIMEOUT;
+		}
+
+		/* Scan for the end of line. */
+		while (port->rx.head != port->rx.tail && i < size - 1) {
+			c = port->rx.buf[port->rx.head++ & (RXBUF_SIZE - 1)];
+			s[i++] = c;
+			if (c == '\n') {
+				s[i] = '\0';
+				return 0;
+			}
 		}
 	}
 	return ERROR_SIZE;
 }
 
-static int print_error(int code)
+/* Print a message (prefixed with the device name in gang mode). */
+void message(struct port *port, const char *fmt, ...)
+{
+	FILE *out = port->out ? port->out : stdout;
+	va_list ap;
+
+	flockfile(out);
+	if (port->name)
+		fprintf(out, "%s: ", port->name);
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	va_end(ap);
+	funlockfile(out);
+}
+
+/* Print an error message, on port->out if set (else stderr). */
+void error_message(struct port *port, const char *fmt, ...)
+{
+	FILE *out = port->out ? port->out : stderr;
+	va_list ap;
+
+	flockfile(out);
+	if (port->name)
+		fprintf(out, "%s: ", port->name);
+	va_start(ap, fmt);
+	vfprintf(out, fmt, ap);
+	va_end(ap);
+	funlockfile(out);
+}
+
+/* Discard received data. */
+void flush_input(struct port *port)
+{
+	tcflush(port->fd, TCIFLUSH);
+	port->rx.head = port->rx.tail;
+}
+
+static int print_error(struct port *port, int code)
 {
 	/* UART ISP Return Codes */
 	static char *code_table[] = {
@@ -144,30 +297,37 @@ static int print_error(int code)
 	};
 
 	if (code < 0 || code >= sizeof(code_table) / sizeof(char *)) {
-		fprintf(stderr, "unknown return code\n");
+		error_message(port, "unknown return code\n");
 		return ERROR_INVALID_VALUE;
 	}
-	fprintf(stderr, "%s\n", code_table[code]);
+	error_message(port, "%s\n", code_table[code]);
 	return code;
 }
 
 /* ISP initialization */
-int isp_init(int fd, int retry)
+int isp_init(struct port *port, int retry)
 {
 	int i;
 	char buf[32];
 	int r;
 
+	trace_command(port, '?');
 	for (i = 0; i < retry; i++) {
+		if (i)
+			trace_retry(port);
+
 		/* Send '?'(0x3F) */
 		buf[0] = '?';
-		if (write(fd, buf, 1) < 0) {
-			perror("write() failed");
+		if (write(port->fd, buf, 1) < 0) {
+			error_message(port, "write() failed: %s\n",
+				      strerror(errno));
 			return -1;
 		}
+		trace_io(port, 1, 0);
 
 		/* Wait for "Synchronized" */
-		r = com_gets(fd, buf, sizeof(buf));
+		port->busy = SYNC_TIMEOUT;
+		r = com_gets(port, buf, sizeof(buf));
 		if (r < 0)
 			return r;
 		if (!r && !strcmp(buf, "Synchronized\r\n")) {
@@ -175,51 +335,51 @@ int isp_init(int fd, int retry)
 		}
 	}
 	if (i >= retry) {
-		fprintf(stderr, "can't get \"Synchronized\"\n");
+		error_message(port, "can't get \"Synchronized\"\n");
 		return -1;
 	}
 
 	if (debug)
-		printf("Synchronized\n");
+		message(port, "Synchronized\n");
 
 	/* Send "Synchronized" */
-	r = com_puts(fd, "Synchronized\r\n");
+	r = com_puts(port, "Synchronized\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send \"Synchronized\"\n");
+		error_message(port, "can't send \"Synchronized\"\n");
 		return r;
 	}
 
 	/* Wait for "OK" */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r || strcmp(buf, "OK\r\n")) {
-		fprintf(stderr, "can't get \"OK\"\n");
+		error_message(port, "can't get \"OK\"\n");
 		if (r)
 			return r;
 		return ERROR_INVALID_VALUE;
 	}
 
 	if (debug)
-		printf("OK\n");
+		message(port, "OK\n");
 
 	/* Send clock frequency */
-	r = com_puts(fd, "12000\r\n");
+	r = com_puts(port, "12000\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send clock frequency\n");
+		error_message(port, "can't send clock frequency\n");
 		return r;
 	}
 
 	/* Wait for "OK" */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r || strcmp(buf, "OK\r\n")) {
-		fprintf(stderr, "can't get \"OK\"\n");
+		error_message(port, "can't get \"OK\"\n");
 		if (r)
 			return r;
 		return ERROR_INVALID_VALUE;
@@ -229,157 +389,161 @@ int isp_init(int fd, int retry)
 }
 
 /* Unlock */
-int unlock(int fd)
+int unlock(struct port *port)
 {
 	int r;
 	char buf[32];
 
+	trace_command(port, 'U');
 	if (debug)
-		printf("Unlock\n");
+		message(port, "Unlock\n");
 
 	/* Send Unlock command */
-	r = com_puts(fd, "U 23130\r\n");
+	r = com_puts(port, "U 23130\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Unlock command\n");
+		error_message(port, "can't send Unlock command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Set Baud Rate */
-int set_baud_rate(int fd, char *baud, int stop)
+int set_baud_rate(struct port *port, char *baud, int stop)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'B');
 	if (debug)
-		printf("Set Baud Rate (%s %d)\n", baud, stop);
+		message(port, "Set Baud Rate (%s %d)\n", baud, stop);
 
 	/* Send Set Baud Rate command */
 	sprintf(buf, "B %s %d\r\n", baud, stop);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Set Baud Rate command\n");
+		error_message(port, "can't send Set Baud Rate command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Echo */
-int echo(int fd, int setting)
+int echo(struct port *port, int setting)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'A');
 	if (debug)
-		printf("Echo (%d)\n", setting);
+		message(port, "Echo (%d)\n", setting);
 
 	/* Send Echo command */
 	sprintf(buf, "A %d\r\n", setting);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Echo command\n");
+		error_message(port, "can't send Echo command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
-	echo_disable = setting ? false : true;
+	port->echo_disable = setting ? false : true;
 
 	return 0;
 }
 
 /* Write to RAM */
-int write_to_ram(int fd, uint32_t addr, int bytes, uint8_t *data)
+int write_to_ram(struct port *port, uint32_t addr, int bytes, uint8_t *data)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'W');
 	if (debug)
-		printf("Write to RAM (0x%08x %d)\n", addr, bytes);
+		message(port, "Write to RAM (0x%08x %d)\n", addr, bytes);
 
 	/* Send Write to RAM command */
 	sprintf(buf, "W %u %d\r\n", addr, bytes);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Write to RAM command\n");
+		error_message(port, "can't send Write to RAM command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Send data */
-	r = com_write(fd, (char *)data, bytes);
+	r = com_write(port, (char *)data, bytes);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send data\n");
+		error_message(port, "can't send data\n");
 		return r;
 	}
 
@@ -387,45 +551,46 @@ int write_to_ram(int fd, uint32_t addr, int bytes, uint8_t *data)
 }
 
 /* Read Memory */
-int read_memory(int fd, uint32_t addr, int bytes, uint8_t *data)
+int read_memory(struct port *port, uint32_t addr, int bytes, uint8_t *data)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'R');
 	if (debug)
-		printf("Read Memory (0x%08x %d)\n", addr, bytes);
+		message(port, "Read Memory (0x%08x %d)\n", addr, bytes);
 
 	/* Send Read Memory command */
 	sprintf(buf, "R %u %d\r\n", addr, bytes);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Read Memory command\n");
+		error_message(port, "can't send Read Memory command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Get data */
-	r = com_read(fd, (char *)data, bytes);
+	r = com_read(port, (char *)data, bytes);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get data\n");
+		error_message(port, "can't get data\n");
 		return r;
 	}
 
@@ -433,291 +598,305 @@ int read_memory(int fd, uint32_t addr, int bytes, uint8_t *data)
 }
 
 /* Prepare sectors for write operation */
-int prepare_sectors(int fd, int start, int end)
+int prepare_sectors(struct port *port, int start, int end)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'P');
 	if (debug)
-		printf("Prepare sectors for write operation (%d %d)\n",
-		       start, end);
+		message(port, "Prepare sectors for write operation (%d %d)\n",
+			start, end);
 
 	/* Send Prepare sectors for write operation command */
 	sprintf(buf, "P %d %d\r\n", start, end);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Prepare sectors for write "
+		error_message(port, "can't send Prepare sectors for write "
 			"operation  command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Copy RAM to flash */
-int copy_ram_to_flash(int fd, uint32_t flash, uint32_t ram, int bytes)
+int copy_ram_to_flash(struct port *port, uint32_t flash, uint32_t ram,
+		      int bytes)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'C');
 	if (debug)
-		printf("Copy RAM to flash (0x%08x 0x%08x %d)\n",
-		       flash, ram, bytes);
+		message(port, "Copy RAM to flash (0x%08x 0x%08x %d)\n",
+			flash, ram, bytes);
 
 	/* Send Copy RAM to flash command */
 	sprintf(buf, "C %u %u %d\r\n", flash, ram, bytes);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Copy RAM to flash command\n");
+		error_message(port, "can't send Copy RAM to flash command\n");
 		return r;
 	}
 
+	port->busy = (bytes + PAGE_SIZE - 1) / PAGE_SIZE * WRITE_TIME;
+
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Go */
-int go(int fd, uint32_t addr)
+int go(struct port *port, uint32_t addr)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'G');
 	if (debug)
-		printf("Go (0x%08x)\n", addr);
+		message(port, "Go (0x%08x)\n", addr);
 
 	/* Send Go command */
 	sprintf(buf, "G %u T\r\n", addr);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Go command\n");
+		error_message(port, "can't send Go command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Erase sectors */
-int erase_sectors(int fd, int start, int end)
+int erase_sectors(struct port *port, int start, int end)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'E');
 	if (debug)
-		printf("Erase sectors (%d %d)\n", start, end);
+		message(port, "Erase sectors (%d %d)\n", start, end);
 
 	/* Send Erase sectors command */
 	sprintf(buf, "E %d %d\r\n", start, end);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Erase sectors command\n");
+		error_message(port, "can't send Erase sectors command\n");
 		return r;
 	}
 
+	port->busy = (end - start + 1) * ERASE_TIME;
+
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	return 0;
 }
 
 /* Blank check sectors */
-int blank_check_sectors(int fd, int start, int end)
+int blank_check_sectors(struct port *port, int start, int end)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'I');
 	if (debug)
-		printf("Blank check sectors (%d %d)\n", start, end);
+		message(port, "Blank check sectors (%d %d)\n", start, end);
 
 	/* Send Blank check sectors command */
 	sprintf(buf, "I %d %d\r\n", start, end);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Blank check sectors command\n");
+		error_message(port, "can't send Blank check sectors command\n");
 		return r;
 	}
 
+	port->busy = (end - start + 1) * READ_TIME;
+
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r == RESULT_SECTOR_NOT_BLANK) {
 		/* Offset */
-		r = com_gets(fd, buf, sizeof(buf));
+		r = com_gets(port, buf, sizeof(buf));
 		if (r < 0)
 			return r;
 		if (r) {
-			fprintf(stderr, "can't get offset\n");
+			error_message(port, "can't get offset\n");
 			return r;
 		}
-		if (sscanf(buf, "%u/r/n", &offset) != 1) {
-			fprintf(stderr, "invalid offset\n");
+		if (sscanf(buf, "%u/r/n", &port->offset) != 1) {
+			error_message(port, "invalid offset\n");
 			return ERROR_INVALID_VALUE;
 		}
 
 		/* Contents */
-		r = com_gets(fd, buf, sizeof(buf));
+		r = com_gets(port, buf, sizeof(buf));
 		if (r < 0)
 			return r;
 		if (r) {
-			fprintf(stderr, "can't get contents\n");
+			error_message(port, "can't get contents\n");
 			return r;
 		}
-		if (sscanf(buf, "%u/r/n", &contents) != 1) {
-			fprintf(stderr, "invalid contents\n");
+		if (sscanf(buf, "%u/r/n", &port->contents) != 1) {
+			error_message(port, "invalid contents\n");
 			return ERROR_INVALID_VALUE;
 		}
 
 		if (debug)
-			printf("SECTOR_NOT_BLANK %u 0x%08x\n",
-			       offset, contents);
+			message(port, "SECTOR_NOT_BLANK %u 0x%08x\n",
+				port->offset, port->contents);
 
 		return RESULT_SECTOR_NOT_BLANK;
 	} else if (r) {
-		return print_error(r);
+		return print_error(port, r);
 	}
 
 	return 0;
 }
 
 /* Read Boot code version numver */
-int read_boot_code_version(int fd, uint8_t *version)
+int read_boot_code_version(struct port *port, uint8_t *version)
 {
 	int r;
 	char buf[32];
 
+	trace_command(port, 'K');
 	if (debug)
-		printf("Read Boot code version number\n");
+		message(port, "Read Boot code version number\n");
 
 	/* Send Read Boot code version command */
-	r = com_puts(fd, "K\r\n");
+	r = com_puts(port, "K\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Read Boot code version command\n");
+		error_message(port, "can't send Read Boot code version "
+			"command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Get Minor version */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get minor version number\n");
+		error_message(port, "can't get minor version number\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid minor version number\n");
+		error_message(port, "invalid minor version number\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r < 0 || r > 255) {
-		fprintf(stderr, "invalid minor version number\n");
+		error_message(port, "invalid minor version number\n");
 		return ERROR_INVALID_VALUE;
 	}
 	*version++ = r;
 
 	/* Get Major version */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get major version number\n");
+		error_message(port, "can't get major version number\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid major version number\n");
+		error_message(port, "invalid major version number\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r < 0 || r > 255) {
-		fprintf(stderr, "invalid major version number\n");
+		error_message(port, "invalid major version number\n");
 		return ERROR_INVALID_VALUE;
 	}
 	*version = r;
@@ -726,49 +905,50 @@ int read_boot_code_version(int fd, uint8_t *version)
 }
 
 /* Read Part Identidication numver */
-int read_part_id(int fd, uint32_t *pid)
+int read_part_id(struct port *port, uint32_t *pid)
 {
 	int r;
 	char buf[32];
 
+	trace_command(port, 'J');
 	if (debug)
-		printf("Read Part Identification number\n");
+		message(port, "Read Part Identification number\n");
 
 	/* Send Read Part Identification command */
-	r = com_puts(fd, "J\r\n");
+	r = com_puts(port, "J\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Read Part Identification "
+		error_message(port, "can't send Read Part Identification "
 			"command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Get Part Identification number */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get Part Identification number\n");
+		error_message(port, "can't get Part Identification number\n");
 		return r;
 	}
 	if (sscanf(buf, "%u/r/n", pid) != 1) {
-		fprintf(stderr, "invalid Part Identification number\n");
+		error_message(port, "invalid Part Identification number\n");
 		return ERROR_INVALID_VALUE;
 	}
 
@@ -776,154 +956,166 @@ int read_part_id(int fd, uint32_t *pid)
 }
 
 /* Compare */
-int compare(int fd, uint32_t addr1, uint32_t addr2, int bytes)
+int compare(struct port *port, uint32_t addr1, uint32_t addr2, int bytes)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'M');
 	if (debug)
-		printf("Compare (0x%08x 0x%08x %d)\n", addr1, addr2, bytes);
+		message(port, "Compare (0x%08x 0x%08x %d)\n", addr1, addr2,
+			bytes);
 
 	/* Send Compare command */
 	sprintf(buf, "M %u %u %d\r\n", addr1, addr2, bytes);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Compare command\n");
+		error_message(port, "can't send Compare command\n");
 		return r;
 	}
 
+	port->busy = (bytes / SECTOR_SIZE + 1) * READ_TIME;
+
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r == RESULT_COMPARE_ERROR) {
 		/* Offset */
-		r = com_gets(fd, buf, sizeof(buf));
+		r = com_gets(port, buf, sizeof(buf));
 		if (r < 0)
 			return r;
 		if (r) {
-			fprintf(stderr, "can't get offset\n");
+			error_message(port, "can't get offset\n");
 			return r;
 		}
-		if (sscanf(buf, "%u/r/n", &offset) != 1) {
-			fprintf(stderr, "invalid offset\n");
+		if (sscanf(buf, "%u/r/n", &port->offset) != 1) {
+			error_message(port, "invalid offset\n");
 			return ERROR_INVALID_VALUE;
 		}
 
 		if (debug)
-			printf("COMPARE_ERROR %u\n", offset);
+			message(port, "COMPARE_ERROR %u\n", port->offset);
 
 		return RESULT_COMPARE_ERROR;
 	} else if (r) {
-		return print_error(r);
+		return print_error(port, r);
 	}
 
 	return 0;
 }
 
-/* Read UID */
-int read_uid(int fd, uint32_t *uid)
+/* Read UID (4 words, the least significant first) */
+int read_uid(struct port *port, uint32_t *uid)
 {
 	int r;
+	int i;
 	char buf[32];
 
+	trace_command(port, 'N');
 	if (debug)
-		printf("Read UID\n");
+		message(port, "Read UID\n");
 
 	/* Send Read UID command */
-	r = com_puts(fd, "N\r\n");
+	r = com_puts(port, "N\r\n");
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Read UID command\n");
+		error_message(port, "can't send Read UID command\n");
 		return r;
 	}
 
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Get UID */
-	r = com_gets(fd, buf, sizeof(buf));
-	if (r < 0)
-		return r;
-	if (r) {
-		fprintf(stderr, "can't get UID\n");
-		return r;
-	}
-	if (sscanf(buf, "%u/r/n", uid) != 1) {
-		fprintf(stderr, "invalid UID\n");
-		return ERROR_INVALID_VALUE;
+	for (i = 0; i < UID_WORDS; i++) {
+		r = com_gets(port, buf, sizeof(buf));
+		if (r < 0)
+			return r;
+		if (r) {
+			error_message(port, "can't get UID\n");
+			return r;
+		}
+		if (sscanf(buf, "%u/r/n", &uid[i]) != 1) {
+			error_message(port, "invalid UID\n");
+			return ERROR_INVALID_VALUE;
+		}
 	}
 
 	return 0;
 }
 
 /* Read CRC checksum */
-int read_crc_checksum(int fd, uint32_t addr, int bytes, uint32_t *checksum)
+int read_crc_checksum(struct port *port, uint32_t addr, int bytes,
+		      uint32_t *checksum)
 {
 	char buf[32];
 	int r;
 
+	trace_command(port, 'S');
 	if (debug)
-		printf("Read CRC checksum\n");
+		message(port, "Read CRC checksum\n");
 
 	/* Send Read CRC checksum command */
 	sprintf(buf, "S %u %d\r\n", addr, bytes);
-	r = com_puts(fd, buf);
+	r = com_puts(port, buf);
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't send Read CRC checksum command\n");
+		error_message(port, "can't send Read CRC checksum command\n");
 		return r;
 	}
 
+	port->busy = (bytes / SECTOR_SIZE + 1) * READ_TIME;
+
 	/* Get UART ISP Return code */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get return code\n");
+		error_message(port, "can't get return code\n");
 		return r;
 	}
 	if (sscanf(buf, "%d/r/n", &r) != 1) {
-		fprintf(stderr, "invalid return code\n");
+		error_message(port, "invalid return code\n");
 		return ERROR_INVALID_VALUE;
 	}
 	if (r)
-		return print_error(r);
+		return print_error(port, r);
 
 	/* Get checksum */
-	r = com_gets(fd, buf, sizeof(buf));
+	r = com_gets(port, buf, sizeof(buf));
 	if (r < 0)
 		return r;
 	if (r) {
-		fprintf(stderr, "can't get checksum\n");
+		error_message(port, "can't get checksum\n");
 		return r;
 	}
 	if (sscanf(buf, "%u/r/n", checksum) != 1) {
-		fprintf(stderr, "invalid checksum\n");
+		error_message(port, "invalid checksum\n");
 		return ERROR_INVALID_VALUE;
 	}
 
@@ -72,20 +72,65 @@
 
 #define PAGE_SIZE		64
 #define SECTOR_SIZE		1024
+#define UID_WORDS		4
 
-int isp_init(int fd, int retry);
-int unlock(int fd);
-int set_baud_rate(int fd, char *baud, int stop);
-int echo(int fd, int setting);
-int write_to_ram(int fd, uint32_t addr, int bytes, uint8_t *data);
-int read_memory(int fd, uint32_t addr, int bytes, uint8_t *data);
-int prepare_sectors(int fd, int start, int end);
-int copy_ram_to_flash(int fd, uint32_t flash, uint32_t ram, int bytes);
-int go(int fd, uint32_t addr);
-int erase_sectors(int fd, int start, int end);
-int blank_check_sectors(int fd, int start, int end);
-int read_boot_code_version(int fd, uint8_t *version);
-int read_part_id(int fd, uint32_t *pid);
-int compare(int fd, uint32_t addr1, uint32_t addr2, int bytes);
-int read_uid(int fd, uint32_t *uid);
-int read_crc_checksum(int fd, uint32_t addr, int bytes, uint32_t *checksum);
+#define RXBUF_SIZE		4096	/* must be a power of 2 */
+
+/* Timeouts (ms) */
+#define LINK_LATENCY		50	/* adapter and ISP turnaround */
+#define SYNC_TIMEOUT		200	/* per sync attempt */
+#define ERASE_TIME		120	/* per sector */
+#define WRITE_TIME		2	/* per page */
+#define READ_TIME		2	/* per sector (I, M and S commands) */
+
+/* ISP link */
+struct port {
+	int fd;
+	char *name;		/* device name */
+	int baud;		/* current line speed */
+	long long drain;	/* time the output has been sent (ms) */
+	long long deadline;	/* of the current transfer (ms) */
+	int busy;		/* time the device needs to answer (ms) */
+	int sram_size;
+	bool echo_disable;
+	uint32_t offset;	/* SECTOR_NOT_BLANK, COMPARE_ERROR */
+	uint32_t contents;	/* SECTOR_NOT_BLANK */
+	struct trace *trace;	/* timing records (or NULL) */
+	int phase;		/* for the records */
+	int window;		/* window of the flash stub (bytes) */
+	int seq;		/* of the next window */
+	FILE *out;		/* for messages (NULL: stdout) */
+
+	/* Receive buffer (ring buffer) */
+	struct {
+		char buf[RXBUF_SIZE];
+		unsigned int head;	/* read index */
+		unsigned int tail;	/* write index */
+	} rx;
+};
+
+int com_read(struct port *port, char *s, int size);
+int com_write(struct port *port, char *s, int size);
+void message(struct port *port, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+void error_message(struct port *port, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+void flush_input(struct port *port);
+int isp_init(struct port *port, int retry);
+int unlock(struct port *port);
+int set_baud_rate(struct port *port, char *baud, int stop);
+int echo(struct port *port, int setting);
+int write_to_ram(struct port *port, uint32_t addr, int bytes, uint8_t *data);
+int read_memory(struct port *port, uint32_t addr, int bytes, uint8_t *data);
+int prepare_sectors(struct port *port, int start, int end);
+int copy_ram_to_flash(struct port *port, uint32_t flash, uint32_t ram,
+		      int bytes);
+int go(struct port *port, uint32_t addr);
+int erase_sectors(struct port *port, int start, int end);
+int blank_check_sectors(struct port *port, int start, int end);
+int read_boot_code_version(struct port *port, uint8_t *version);
+int read_part_id(struct port *port, uint32_t *pid);
+int compare(struct port *port, uint32_t addr1, uint32_t addr2, int bytes);
+int read_uid(struct port *port, uint32_t *uid);
+int read_crc_checksum(struct port *port, uint32_t addr, int bytes,
+		      uint32_t *checksum);
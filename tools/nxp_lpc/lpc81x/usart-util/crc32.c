@@ -0,0 +1,58 @@
+/*
+ * crc32.c - CRC-32 checksum of the Read CRC checksum ('S') command
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "crc32.h"
+
+/* CRC-32 (IEEE 802.3), reflected polynomial */
+#define CRC32_POLY	0xedb88320
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void)
+{
+	uint32_t c;
+	int i;
+	int j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (c & 1 ? CRC32_POLY : 0);
+		crc_table[i] = c;
+	}
+}
+
+uint32_t crc32(uint8_t *data, int bytes)
+{
+	uint32_t crc;
+
+	/* Called from the threads of several devices */
+	pthread_once(&crc_table_once, make_crc_table);
+
+	crc = 0xffffffff;
+	while (bytes--)
+		crc = crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
@@ -0,0 +1,505 @@
+/*
+ * daemon.c
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * With -S the devices are synchronized once and stay in the ISP; jobs
+ * come from a UNIX socket, one per connection, and run on every device
+ * of the job at the same time.  Before a job each device is asked for its
+ * part ID, and only a device that doesn't answer (reset or replaced) is
+ * synchronized again.  Jobs are run one after another.
+ *
+ * Request (lines, ended by an empty line):
+ *	device <dev>		(0 or more; none: all devices)
+ *	option c		(verify by CRC)
+ *	option i		(skip unchanged sectors)
+ *	patch <patch>		(0 or more, see patch.c)
+ *	download <file>
+ *	upload <bytes> <file>
+ *	crc <address> <bytes>
+ *	uid
+ * File names are absolute; the daemon opens the files.  The socket is
+ * made accessible to the owner only, and a job from another user (by
+ * SO_PEERCRED) is refused, so the files are opened with the rights of
+ * the client.
+ *
+ * Reply: the messages of the job, then "OK" or "FAILED".
+ */
+
+#define _GNU_SOURCE		/* struct ucred */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "command.h"
+#include "image.h"
+#include "patch.h"
+#include "session.h"
+#include "daemon.h"
+
+#define LINE_SIZE	(PATH_MAX + 32)
+
+extern bool crc_verify;
+extern bool incremental;
+
+/* A job on one device */
+struct task {
+	struct session *s;
+	struct request *req;
+	pthread_t thread;
+	bool started;
+	int result;		/* bytes transferred, or -1 */
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void *run_task(void *arg)
+{
+	struct task *t = arg;
+
+	t->result = -1;
+	if (session_check(t->s))
+		return NULL;
+	t->result = session_run(t->s, t->req);
+	return NULL;
+}
+
+/* Return 0, or -1 with an error message in out. */
+static int read_request(FILE *in, FILE *out, struct request *req,
+			char *fname, struct session *s, bool *selected, int n)
+{
+	char line[LINE_SIZE];
+	char *p;
+	int len;
+	int i;
+
+	req->type = -1;
+	while (fgets(line, sizeof(line), in)) {
+		len = strlen(line);
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0) {
+			if (req->type < 0)
+				break;
+			return 0;
+		}
+
+		if (!strncmp(line, "device ", 7)) {
+			for (i = 0; i < n; i++) {
+				if (!strcmp(line + 7, s[i].usart))
+					break;
+			}
+			if (i >= n) {
+				fprintf(out, "%s: no such device\n",
+					line + 7);
+				return -1;
+			}
+			selected[i] = true;
+		} else if (!strcmp(line, "option c")) {
+			crc_verify = true;
+		} else if (!strcmp(line, "option i")) {
+			incremental = true;
+		} else if (!strncmp(line, "patch ", 6)) {
+			if (req->npatch >= MAX_PATCHES) {
+				fprintf(out, "too many patches\n");
+				return -1;
+			}
+			if (patch_parse(&req->patch[req->npatch], line + 6,
+					out))
+				return -1;
+			req->npatch++;
+		} else if (!strncmp(line, "download ", 9)) {
+			req->type = JOB_DOWNLOAD;
+			strcpy(fname, line + 9);
+		} else if (!strncmp(line, "upload ", 7)) {
+			req->type = JOB_UPLOAD;
+			req->bytes = strtol(line + 7, &p, 0);
+			if (*p++ != ' ' || req->bytes <= 0)
+				break;
+			strcpy(fname, p);
+		} else if (!strncmp(line, "crc ", 4)) {
+			req->type = JOB_CRC;
+			req->addr = strtoul(line + 4, &p, 0);
+			req->bytes = strtol(p, &p, 0);
+			if (*p || req->bytes <= 0)
+				break;
+		} else if (!strcmp(line, "uid")) {
+			req->type = JOB_UID;
+		} else {
+			break;
+		}
+	}
+	fprintf(out, "invalid request\n");
+	return -1;
+}
+
+/* Run a request of a client. */
+static void handle(int fd, struct session *s, int n, struct image *image)
+{
+	FILE *in;
+	FILE *out;
+	struct request req;
+	struct patch patch[MAX_PATCHES];
+	char fname[LINE_SIZE];
+	bool selected[n];
+	struct task task[n];
+	struct task *t;
+	struct ucred cred;
+	socklen_t len;
+	int ntask;
+	int failed;
+	int i;
+
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	if (in == NULL || out == NULL) {
+		perror("fdopen() failed");
+		if (in)
+			fclose(in);
+		else
+			close(fd);
+		if (out)
+			fclose(out);
+		return;
+	}
+	setvbuf(out, NULL, _IOLBF, 0);
+
+	crc_verify = false;
+	incremental = false;
+	memset(selected, 0, sizeof(selected));
+	failed = 1;
+	req.patch = patch;
+	req.npatch = 0;
+	len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+	    cred.uid != geteuid()) {
+		fprintf(out, "permission denied\n");
+		goto done;
+	}
+	if (read_request(in, out, &req, fname, s, selected, n))
+		goto done;
+	if (req.npatch && req.type != JOB_DOWNLOAD) {
+		fprintf(out, "patches can only be used with download\n");
+		goto done;
+	}
+	req.fname = fname;
+	req.image = image;
+	if (req.type == JOB_DOWNLOAD && image_load(image, fname, out))
+		goto done;
+
+	ntask = 0;
+	for (i = 0; i < n; i++) {
+		if (selected[i])
+			ntask++;
+	}
+	for (i = 0; i < n; i++)
+		selected[i] = selected[i] || !ntask;
+	ntask = 0;
+	for (i = 0; i < n; i++) {
+		if (!selected[i])
+			continue;
+		task[ntask].s = &s[i];
+		task[ntask].req = &req;
+		s[i].port.out = out;
+		ntask++;
+	}
+	if (ntask > 1 && req.type == JOB_UPLOAD) {
+		fprintf(out, "upload can't be used with several "
+			"devices\n");
+		goto done;
+	}
+
+	if (ntask == 1) {
+		run_task(&task[0]);
+	} else {
+		for (i = 0; i < ntask; i++) {
+			t = &task[i];
+			t->started = !pthread_create(&t->thread, NULL,
+						     run_task, t);
+			if (!t->started) {
+				fprintf(out, "pthread_create() failed\n");
+				t->result = -1;
+			}
+		}
+		for (i = 0; i < ntask; i++) {
+			if (task[i].started)
+				pthread_join(task[i].thread, NULL);
+		}
+
+		/* Summary */
+		for (i = 0; i < ntask; i++) {
+			t = &task[i];
+			if (t->result < 0)
+				fprintf(out, "%-16s FAILED\n", t->s->usart);
+			else
+				fprintf(out, "%-16s OK      %-21s %6d bytes\n",
+					t->s->usart, t->s->dev_name ?
+					t->s->dev_name : "unknown device",
+					t->result);
+		}
+	}
+
+	failed = 0;
+	for (i = 0; i < ntask; i++) {
+		if (task[i].result < 0)
+			failed++;
+	}
+
+done:
+	fprintf(out, failed ? "FAILED\n" : "OK\n");
+	for (i = 0; i < n; i++)
+		s[i].port.out = NULL;
+	for (i = 0; i < req.npatch; i++)
+		patch_free(&patch[i]);
+	fclose(out);
+	fclose(in);
+}
+
+/* Keep the devices synchronized and run the jobs from the socket path. */
+int serve(char *path, struct session *s, int n)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	struct image *image;
+	int opened;
+	int fd;
+	int c;
+	int r;
+	int i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket name too long\n", path);
+		return 1;
+	}
+	image = malloc(sizeof(struct image));
+	if (image == NULL) {
+		perror("malloc() failed");
+		return 1;
+	}
+
+	r = 1;
+	for (opened = 0; opened < n; opened++) {
+		if (session_open(&s[opened]))
+			goto close_sessions;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket() failed");
+		goto close_sessions;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* A socket left by a daemon that has been killed */
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(path);
+		close(fd);
+		goto close_sessions;
+	}
+	if (chmod(path, S_IRUSR | S_IWUSR)) {
+		perror(path);
+		goto close_socket;
+	}
+	if (listen(fd, 8)) {
+		perror("listen() failed");
+		goto close_socket;
+	}
+
+	/* Stop between jobs; accept() returns on a signal. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Waiting for jobs on %s\n", path);
+	fflush(stdout);
+	while (!stop) {
+		c = accept(fd, NULL, NULL);
+		if (c < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept() failed");
+			goto close_socket;
+		}
+		handle(c, s, n, image);
+		fflush(stdout);
+	}
+	r = 0;
+
+close_socket:
+	close(fd);
+	unlink(path);
+close_sessions:
+	for (i = 0; i < opened; i++) {
+		if (session_close(&s[i]))
+			r = 1;
+	}
+	free(image);
+	return r;
+}
+
+/* Send a request to the daemon and print its reply. */
+int submit(char *path, struct request *req, char **usart, int ndev)
+{
+	struct sockaddr_un addr;
+	struct patch *p;
+	FILE *in;
+	FILE *out;
+	char line[LINE_SIZE];
+	char fname[PATH_MAX];
+	char pname[PATH_MAX];
+	int fd;
+	int r;
+	int i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket name too long\n", path);
+		return 1;
+	}
+
+	/* The daemon doesn't know the current directory. */
+	if (req->type == JOB_DOWNLOAD && realpath(req->fname, fname) == NULL) {
+		perror(req->fname);
+		return 1;
+	}
+	if (req->type == JOB_UPLOAD) {
+		if (req->fname[0] == '/') {
+			snprintf(fname, sizeof(fname), "%s", req->fname);
+		} else if (getcwd(fname, sizeof(fname)) == NULL ||
+			   strlen(fname) + strlen(req->fname) + 2 >
+			   sizeof(fname)) {
+			fprintf(stderr, "%s: path too long\n", req->fname);
+			return 1;
+		} else {
+			strcat(fname, "/");
+			strcat(fname, req->fname);
+		}
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket() failed");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(path);
+		close(fd);
+		return 1;
+	}
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	if (in == NULL || out == NULL) {
+		perror("fdopen() failed");
+		if (in)
+			fclose(in);
+		else
+			close(fd);
+		if (out)
+			fclose(out);
+		return 1;
+	}
+
+	for (i = 0; i < ndev; i++)
+		fprintf(out, "device %s\n", usart[i]);
+	if (crc_verify)
+		fprintf(out, "option c\n");
+	if (incremental)
+		fprintf(out, "option i\n");
+	for (i = 0; i < req->npatch; i++) {
+		p = &req->patch[i];
+		fprintf(out, "patch 0x%08x,%s", p->addr, p->name);
+		if (p->type == PATCH_HEX)
+			fprintf(out, ",%s", p->arg);
+		else if (p->arg && realpath(p->arg, pname))
+			fprintf(out, ",%s", pname);
+		else if (p->arg)
+			fprintf(out, ",%s", p->arg);
+		fprintf(out, "\n");
+	}
+	switch (req->type) {
+	case JOB_DOWNLOAD:
+		fprintf(out, "download %s\n", fname);
+		break;
+	case JOB_UPLOAD:
+		fprintf(out, "upload %d %s\n", req->bytes, fname);
+		break;
+	case JOB_CRC:
+		fprintf(out, "crc 0x%08x %d\n", req->addr, req->bytes);
+		break;
+	case JOB_UID:
+		fprintf(out, "uid\n");
+		break;
+	}
+	fprintf(out, "\n");
+	if (fflush(out)) {
+		perror("write() failed");
+		fclose(out);
+		fclose(in);
+		return 1;
+	}
+
+	r = -1;
+	while (fgets(line, sizeof(line), in)) {
+		if (!strcmp(line, "OK\n")) {
+			r = 0;
+			break;
+		}
+		if (!strcmp(line, "FAILED\n")) {
+			r = 1;
+			break;
+		}
+		fputs(line, stdout);
+	}
+	if (r < 0) {
+		fprintf(stderr, "%s: connection closed\n", path);
+		r = 1;
+	}
+	fclose(out);
+	fclose(in);
+	return r;
+}
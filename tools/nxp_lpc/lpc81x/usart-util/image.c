@@ -0,0 +1,394 @@
+/*
+ * image.c - Load a flash image (binary, ELF, Intel HEX or S-record).
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The format is detected from the contents.  The file is mapped, and the
+ * data is placed in a sparse image: only the sectors that contain data
+ * are programmed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "command.h"
+#include "image.h"
+#include "transfer.h"
+
+/* Place data at a flash address.  Errors are written to err. */
+static int store(struct image *image, uint32_t addr, const uint8_t *data,
+		 int bytes, FILE *err)
+{
+	int s;
+	int end;
+
+	if (addr < FLASH_ADDRESS || addr - FLASH_ADDRESS >= IMAGE_SIZE ||
+	    bytes > IMAGE_SIZE - (addr - FLASH_ADDRESS)) {
+		fprintf(err, "data out of flash (0x%08x %d)\n", addr, bytes);
+		return -1;
+	}
+	addr -= FLASH_ADDRESS;
+	memcpy(&image->data[addr], data, bytes);
+	while (bytes > 0) {
+		s = addr / SECTOR_SIZE;
+		end = addr + bytes - s * SECTOR_SIZE;
+		if (end > SECTOR_SIZE)
+			end = SECTOR_SIZE;
+		if (image->end[s] < end)
+			image->end[s] = end;
+		bytes -= (s + 1) * SECTOR_SIZE - addr;
+		addr = (s + 1) * SECTOR_SIZE;
+	}
+	return 0;
+}
+
+static uint32_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* ELF: PT_LOAD segments at their load (physical) addresses */
+static int load_elf(struct image *image, const uint8_t *p, size_t size,
+		    FILE *err)
+{
+	uint32_t phoff;
+	int phentsize;
+	int phnum;
+	const uint8_t *ph;
+	uint32_t offset;
+	uint32_t paddr;
+	uint32_t filesz;
+	int i;
+
+	if (size < sizeof(Elf32_Ehdr) || p[EI_CLASS] != ELFCLASS32 ||
+	    p[EI_DATA] != ELFDATA2LSB ||
+	    get16(p + offsetof(Elf32_Ehdr, e_machine)) != EM_ARM) {
+		fprintf(err, "not a 32-bit little-endian ARM ELF file\n");
+		return -1;
+	}
+	phoff = get32(p + offsetof(Elf32_Ehdr, e_phoff));
+	phentsize = get16(p + offsetof(Elf32_Ehdr, e_phentsize));
+	phnum = get16(p + offsetof(Elf32_Ehdr, e_phnum));
+	if (phentsize < sizeof(Elf32_Phdr) ||
+	    phoff + (uint64_t)phnum * phentsize > size) {
+		fprintf(err, "invalid program header\n");
+		return -1;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		ph = p + phoff + i * phentsize;
+		if (get32(ph + offsetof(Elf32_Phdr, p_type)) != PT_LOAD)
+			continue;
+		offset = get32(ph + offsetof(Elf32_Phdr, p_offset));
+		paddr = get32(ph + offsetof(Elf32_Phdr, p_paddr));
+		filesz = get32(ph + offsetof(Elf32_Phdr, p_filesz));
+		if (filesz == 0)
+			continue;
+		if (offset + (uint64_t)filesz > size) {
+			fprintf(err, "invalid segment\n");
+			return -1;
+		}
+		if (store(image, paddr, p + offset, filesz, err))
+			return -1;
+	}
+	return 0;
+}
+
+static int hex(const uint8_t *p)
+{
+	int i;
+	int v;
+
+	v = 0;
+	for (i = 0; i < 2; i++) {
+		v <<= 4;
+		if (p[i] >= '0' && p[i] <= '9')
+			v |= p[i] - '0';
+		else if (p[i] >= 'A' && p[i] <= 'F')
+			v |= p[i] - 'A' + 10;
+		else if (p[i] >= 'a' && p[i] <= 'f')
+			v |= p[i] - 'a' + 10;
+		else
+			return -1;
+	}
+	return v;
+}
+
+/*
+ * Decode the hex digits of a record (after the start character) into
+ * buf.  Return the number of bytes, or -1.
+ */
+static int decode(const uint8_t *p, const uint8_t *end, uint8_t *buf,
+		  int size)
+{
+	int n;
+	int v;
+
+	for (n = 0; p + 1 < end && (p[0] != '\r' && p[0] != '\n'); n++) {
+		if (n >= size)
+			return -1;
+		v = hex(p);
+		if (v < 0)
+			return -1;
+		buf[n] = v;
+		p += 2;
+	}
+	return n;
+}
+
+/* Intel HEX */
+static int load_ihex(struct image *image, const uint8_t *p, size_t size,
+		     FILE *err)
+{
+	const uint8_t *end = p + size;
+	uint8_t rec[260];
+	uint32_t base;
+	int line;
+	int n;
+	int sum;
+	int i;
+
+	base = 0;
+	for (line = 1; p < end; line++) {
+		if (*p == '\r' || *p == '\n') {
+			p++;
+			line--;
+			continue;
+		}
+		if (*p != ':')
+			goto invalid;
+		n = decode(p + 1, end, rec, sizeof(rec));
+		if (n < 5 || n != rec[0] + 5)
+			goto invalid;
+		sum = 0;
+		for (i = 0; i < n; i++)
+			sum += rec[i];
+		if (sum & 0xff) {
+			fprintf(err, "checksum error in line %d\n", line);
+			return -1;
+		}
+
+		switch (rec[3]) {
+		case 0:		/* Data */
+			if (store(image, base + (rec[1] << 8 | rec[2]),
+				  &rec[4], rec[0], err))
+				return -1;
+			break;
+		case 1:		/* End Of File */
+			return 0;
+		case 2:		/* Extended Segment Address */
+			base = (rec[4] << 8 | rec[5]) << 4;
+			break;
+		case 4:		/* Extended Linear Address */
+			base = (uint32_t)(rec[4] << 8 | rec[5]) << 16;
+			break;
+		default:	/* Start Address */
+			break;
+		}
+
+		while (p < end && *p != '\n')
+			p++;
+	}
+	return 0;
+
+invalid:
+	fprintf(err, "invalid record in line %d\n", line);
+	return -1;
+}
+
+/* Motorola S-record */
+static int load_srec(struct image *image, const uint8_t *p, size_t size,
+		     FILE *err)
+{
+	const uint8_t *end = p + size;
+	uint8_t rec[260];
+	uint32_t addr;
+	int alen;
+	int line;
+	int n;
+	int sum;
+	int i;
+
+	for (line = 1; p < end; line++) {
+		if (*p == '\r' || *p == '\n') {
+			p++;
+			line--;
+			continue;
+		}
+		if (*p != 'S' || p + 1 >= end)
+			goto invalid;
+		n = decode(p + 2, end, rec, sizeof(rec));
+		if (n < 1 || n != rec[0] + 1)
+			goto invalid;
+		sum = 0;
+		for (i = 0; i < n; i++)
+			sum += rec[i];
+		if ((sum & 0xff) != 0xff) {
+			fprintf(err, "checksum error in line %d\n", line);
+			return -1;
+		}
+
+		switch (p[1]) {
+		case '1':
+		case '2':
+		case '3':	/* Data */
+			alen = p[1] - '0' + 1;
+			if (n < alen + 2)
+				goto invalid;
+			addr = 0;
+			for (i = 0; i < alen; i++)
+				addr = addr << 8 | rec[1 + i];
+			if (store(image, addr, &rec[1 + alen], n - alen - 2,
+				  err))
+				return -1;
+			break;
+		case '7':
+		case '8':
+		case '9':	/* Termination */
+			return 0;
+		case '0':	/* Header */
+		case '5':
+		case '6':	/* Count */
+			break;
+		default:
+			goto invalid;
+		}
+
+		while (p < end && *p != '\n')
+			p++;
+	}
+	return 0;
+
+invalid:
+	fprintf(err, "invalid record in line %d\n", line);
+	return -1;
+}
+
+/* Set the checksum of the vector table (if sector 0 is in the image). */
+static void set_checksum(struct image *image)
+{
+	uint8_t *buf = image->data;
+	uint32_t w;
+	int i;
+
+	if (image->end[0] == 0)
+		return;
+
+	w = 0;
+	for (i = 0; i < 7; i++)
+		w += get32(&buf[i * 4]);
+	w = -w;
+	buf[7 * 4] = w & 0xff;
+	buf[7 * 4 + 1] = w >> 8 & 0xff;
+	buf[7 * 4 + 2] = w >> 16 & 0xff;
+	buf[7 * 4 + 3] = w >> 24;
+	if (image->end[0] < 8 * 4)
+		image->end[0] = 8 * 4;
+	image->checksum = w;
+}
+
+static void count_bytes(struct image *image)
+{
+	int i;
+
+	image->bytes = 0;
+	for (i = 0; i < IMAGE_SECTORS; i++)
+		image->bytes += image->end[i];
+}
+
+int image_load(struct image *image, char *fname, FILE *err)
+{
+	int fd;
+	struct stat st;
+	uint8_t *p;
+	int r;
+
+	memset(image->data, 0xff, sizeof(image->data));
+	memset(image->end, 0, sizeof(image->end));
+	image->checksum = 0;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		fprintf(err, "%s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		fprintf(err, "fstat() failed: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		fprintf(err, "%s: empty file\n", fname);
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		fprintf(err, "mmap() failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (st.st_size >= SELFMAG && !memcmp(p, ELFMAG, SELFMAG))
+		r = load_elf(image, p, st.st_size, err);
+	else if (p[0] == ':')
+		r = load_ihex(image, p, st.st_size, err);
+	else if (p[0] == 'S' && st.st_size >= 2 && p[1] >= '0' &&
+		 p[1] <= '9')
+		r = load_srec(image, p, st.st_size, err);
+	else
+		r = store(image, FLASH_ADDRESS, p, st.st_size, err);
+	munmap(p, st.st_size);
+	if (r)
+		return -1;
+
+	set_checksum(image);
+	count_bytes(image);
+	if (image->bytes == 0) {
+		fprintf(err, "%s: no data\n", fname);
+		return -1;
+	}
+	return 0;
+}
+
+/* Overwrite data of a loaded image; the checksum is computed again. */
+int image_patch(struct image *image, uint32_t addr, const uint8_t *data,
+		int bytes, FILE *err)
+{
+	if (store(image, addr, data, bytes, err))
+		return -1;
+	set_checksum(image);
+	count_bytes(image);
+	return 0;
+}
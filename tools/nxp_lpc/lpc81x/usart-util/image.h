@@ -0,0 +1,36 @@
+/*
+ * image.h
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define IMAGE_SIZE	16384	/* largest flash */
+#define IMAGE_SECTORS	(IMAGE_SIZE / SECTOR_SIZE)
+
+/* Flash image (unused bytes are 0xff) */
+struct image {
+	uint8_t data[IMAGE_SIZE];
+	int end[IMAGE_SECTORS];	/* end of data in sector (0: empty) */
+	int bytes;		/* size of data */
+	uint32_t checksum;	/* vector table entry 7 */
+};
+
+/* Errors are written to err. */
+int image_load(struct image *image, char *fname, FILE *err);
+int image_patch(struct image *image, uint32_t addr, const uint8_t *data,
+		int bytes, FILE *err);
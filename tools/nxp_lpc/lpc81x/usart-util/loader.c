@@ -0,0 +1,590 @@
+/*
+ * loader.c - Download through the flash stub.
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The stub (stub/stub.c) is written into SRAM with the ISP and started
+ * with 'G'.  The image is then sent in windows of LZ-compressed frames at
+ * the fastest rate the stub can make from the IRC, and each window is
+ * programmed and checked by CRC on the part with a single reply.  See
+ * stub/stub.h for the protocol.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "image.h"
+#include "transfer.h"
+#include "crc32.h"
+#include "baud.h"
+#include "trace.h"
+#include "loader.h"
+#include "stub/stub.h"
+
+#define RETRY		3
+
+extern bool debug;
+extern bool incremental;
+
+/* Rates tried below the requested maximum */
+static int rate_table[] = {
+	460800, 230400, 115200, 0
+};
+
+/* Load stub.bin. */
+int stub_load(struct stub_image *stub, char *fname)
+{
+	FILE *stream;
+	int n;
+	uint8_t *p;
+
+	stream = fopen(fname, "r");
+	if (stream == NULL) {
+		perror(fname);
+		return -1;
+	}
+	n = fread(stub->data, 1, sizeof(stub->data), stream);
+	if (ferror(stream)) {
+		fprintf(stderr, "%s: read error\n", fname);
+		fclose(stream);
+		return -1;
+	}
+	fclose(stream);
+
+	p = &stub->data[STUB_LOADER - STUB_RAM];
+	stub->loader = n - (STUB_LOADER - STUB_RAM);
+	if (stub->loader <= 4 || stub->loader % 4) {
+		fprintf(stderr, "%s: no loader\n", fname);
+		return -1;
+	}
+	stub->body = p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+	if (stub->body <= 0 || stub->body > STUB_LOADER - STUB_RAM) {
+		fprintf(stderr, "%s: invalid body size (%d)\n", fname,
+			stub->body);
+		return -1;
+	}
+	return 0;
+}
+
+/* CRC-CCITT (seed 0xffff, MSB first) */
+static uint16_t crc_ccitt(const uint8_t *p, int n)
+{
+	uint16_t crc;
+	int i;
+
+	crc = 0xffff;
+	while (n--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = crc << 1 ^ (crc & 0x8000 ? 0x1021 : 0);
+	}
+	return crc;
+}
+
+static int send_frame(struct port *port, int type, const uint8_t *payload,
+		      int len)
+{
+	uint8_t buf[STUB_PAYLOAD_MAX + 5];
+	uint16_t crc;
+	int r;
+
+	trace_command(port, type);
+	buf[0] = STUB_SOF;
+	buf[1] = type;
+	buf[2] = len;
+	memcpy(&buf[3], payload, len);
+	crc = crc_ccitt(&buf[1], len + 2);
+	buf[len + 3] = crc >> 8;
+	buf[len + 4] = crc;
+	r = com_write(port, (char *)buf, len + 5);
+	if (r)
+		error_message(port, "can't send frame (%c)\n", type);
+	return r;
+}
+
+static void put16(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+/*
+ * Get the reply of a frame.  busy: time the stub needs (ms)
+ * Return the status, or a negative value (or ERROR_*) on link error.
+ */
+static int get_reply(struct port *port, int type, int busy, int *seq)
+{
+	char buf[4];
+	int r;
+
+	port->busy = busy;
+	do {
+		r = com_read(port, buf, 1);
+		if (r)
+			return r;
+	} while (buf[0] != STUB_SOF);
+	r = com_read(port, &buf[1], 3);
+	if (r)
+		return r;
+	if (buf[1] != type) {
+		error_message(port, "unexpected reply (%c to %c)\n", buf[1],
+			      type);
+		return ERROR_INVALID_VALUE;
+	}
+	if (seq)
+		*seq = (uint8_t)buf[3];
+	if (debug)
+		message(port, "%c: status 0x%02x\n", type, (uint8_t)buf[2]);
+	return (uint8_t)buf[2];
+}
+
+static void print_status(struct port *port, int status)
+{
+	switch (status) {
+	case STUB_BAD_FRAME:
+		error_message(port, "stub: frame lost\n");
+		break;
+	case STUB_BAD_DATA:
+		error_message(port, "stub: data CRC error\n");
+		break;
+	case STUB_VERIFY_ERROR:
+		error_message(port, "Verify failed\n");
+		break;
+	case STUB_INVALID:
+		error_message(port, "stub: invalid frame\n");
+		break;
+	default:
+		error_message(port, "stub: IAP status %d\n", status);
+		break;
+	}
+}
+
+/*
+ * USART divider for a rate: U_PCLK = STUB_CLOCK / (1 + mult / 256),
+ * rate = U_PCLK / 16 / (brg + 1).  Return -1 if the error exceeds 2%.
+ */
+static int divider(int rate, int *brg, int *mult)
+{
+	long long num;
+	long long den;
+	int div;
+	int m;
+	int actual;
+
+	div = STUB_CLOCK / 16 / rate;
+	if (div < 1)
+		return -1;
+	num = 256LL * STUB_CLOCK;
+	den = 16LL * rate * div;
+	m = (num + den / 2) / den - 256;
+	if (m > 255)
+		m = 255;
+	actual = num / (16LL * div * (256 + m));
+	if (actual > rate + rate / 50 || actual < rate - rate / 50)
+		return -1;
+	*brg = div - 1;
+	*mult = m;
+	return 0;
+}
+
+/* Fastest rate up to max (or the current one) */
+static int stub_rate(struct port *port, int max, int *brg, int *mult)
+{
+	int i;
+
+	if (max > port->baud && !divider(max, brg, mult))
+		return max;
+	for (i = 0; rate_table[i]; i++) {
+		if (rate_table[i] < max && rate_table[i] > port->baud &&
+		    !divider(rate_table[i], brg, mult))
+			return rate_table[i];
+	}
+	if (divider(port->baud, brg, mult)) {
+		error_message(port, "stub can't make %d baud\n", port->baud);
+		return -1;
+	}
+	return port->baud;
+}
+
+/* Write the stub, start it and set it up. */
+int stub_start(struct port *port, struct stub_image *stub, int max_baud)
+{
+	uint8_t payload[10];
+	uint32_t buffer;
+	int window;
+	int rate;
+	int brg;
+	int mult;
+	int seq;
+	int r;
+
+	/*
+	 * 'W' writes the loader while the ISP runs, so it must stay below
+	 * the ISP stack.  On the LPC810 all the SRAM 'W' accepts is stack.
+	 */
+	if (STUB_LOADER + stub->loader > SRAM_ADDRESS + port->sram_size -
+	    IAP_RAM_SIZE - ISP_STACK_SIZE) {
+		error_message(port, "no room for the stub loader below the "
+			      "ISP stack (%d KB SRAM)\n",
+			      port->sram_size / 1024);
+		return -1;
+	}
+
+	/* Window buffer: above 1 KB */
+	buffer = STUB_STACK + IAP_RAM_SIZE;
+	window = SRAM_ADDRESS + port->sram_size - IAP_RAM_SIZE - buffer;
+	window &= ~(PAGE_SIZE - 1);
+	if (window > 0xffff)
+		window = 0xffff & ~(PAGE_SIZE - 1);
+
+	rate = stub_rate(port, max_baud, &brg, &mult);
+	if (rate < 0)
+		return -1;
+
+	if (unlock(port))
+		return -1;
+
+	port->phase = PHASE_SYNC;
+	if (write_to_ram(port, STUB_LOADER, stub->loader,
+			 &stub->data[STUB_LOADER - STUB_RAM]))
+		return -1;
+	if (go(port, STUB_ENTRY))
+		return -1;
+
+	/* The loader takes the body in raw binary. */
+	trace_command(port, STUB_HELLO);
+	if (com_write(port, (char *)stub->data, stub->body)) {
+		error_message(port, "can't send stub\n");
+		return -1;
+	}
+	r = get_reply(port, STUB_HELLO, 0, &seq);
+	if (r) {
+		error_message(port, "no response from stub\n");
+		return -1;
+	}
+	if (seq != STUB_VERSION) {
+		error_message(port, "stub version %d (expected %d)\n", seq,
+			STUB_VERSION);
+		return -1;
+	}
+
+	put16(&payload[0], brg);
+	payload[2] = mult;
+	payload[3] = 0;
+	put32(&payload[4], buffer);
+	put16(&payload[8], window);
+	if (send_frame(port, STUB_SETUP, payload, sizeof(payload)))
+		return -1;
+	r = get_reply(port, STUB_SETUP, 0, NULL);
+	if (r) {
+		if (r > 0)
+			print_status(port, r);
+		return -1;
+	}
+	if (rate != port->baud) {
+		if (set_line_speed(port, rate))
+			return -1;
+		usleep(10000);
+	}
+
+	port->window = window;
+	port->seq = 0;
+	message(port, "Stub %d baud, %d-byte window\n", rate, window);
+	if (debug)
+		message(port, "Stub: body %d bytes, buffer 0x%08x\n",
+			stub->body, buffer);
+	return 0;
+}
+
+/* Longest match for data[i] in data[0..i) */
+static int find_match(const uint8_t *data, int i, int n, int *dist)
+{
+	int best;
+	int j;
+	int m;
+	int max;
+
+	max = n - i;
+	if (max > STUB_MATCH_MAX)
+		max = STUB_MATCH_MAX;
+	best = 0;
+	for (j = i - 1; j >= 0 && best < max; j--) {
+		for (m = 0; m < max && data[j + m] == data[i + m]; m++)
+			;
+		if (m > best) {
+			best = m;
+			*dist = i - j;
+		}
+	}
+	return best;
+}
+
+/* Send the data of a window as STUB_DATA frames. */
+static int send_window(struct port *port, const uint8_t *data, int n)
+{
+	uint8_t payload[STUB_PAYLOAD_MAX];
+	int len;
+	int lit;
+	int i;
+	int m;
+	int d;
+
+	port->phase = PHASE_WRITE;
+	i = 0;
+	while (i < n) {
+		put16(payload, i);
+		len = 2;
+		lit = -1;	/* current literal token */
+		while (i < n) {
+			m = find_match(data, i, n, &d);
+			if (m > STUB_MATCH_MIN) {
+				/* A 3-byte token: longer matches only */
+				if (len + 3 > STUB_PAYLOAD_MAX)
+					break;
+				payload[len++] = 0x80 + m - STUB_MATCH_MIN;
+				put16(&payload[len], d);
+				len += 2;
+				i += m;
+				lit = -1;
+			} else if (lit < 0 || payload[lit] == 0x7f) {
+				if (len + 2 > STUB_PAYLOAD_MAX)
+					break;
+				lit = len;
+				payload[len++] = 0;
+				payload[len++] = data[i++];
+			} else {
+				if (len + 1 > STUB_PAYLOAD_MAX)
+					break;
+				payload[lit]++;
+				payload[len++] = data[i++];
+			}
+		}
+		if (send_frame(port, STUB_DATA, payload, len))
+			return -1;
+	}
+	return 0;
+}
+
+/* Program a window and check it.  Resent if a frame is lost. */
+static int write_window(struct port *port, uint32_t addr, const uint8_t *data,
+			int n)
+{
+	uint8_t payload[12];
+	int i;
+	int r;
+	int seq;
+
+	put32(&payload[0], addr);
+	put16(&payload[4], n);
+	payload[6] = port->seq;
+	payload[7] = 0;
+	put32(&payload[8], crc32((uint8_t *)data, n));
+
+	for (i = 0; i < RETRY; i++) {
+		if (i) {
+			trace_retry(port);
+			usleep(LINK_LATENCY * 1000);
+			flush_input(port);
+		}
+		if (debug)
+			message(port, "Window 0x%08x %d (%d)\n", addr, n,
+				port->seq);
+		if (send_window(port, data, n))
+			return -1;
+		port->phase = PHASE_COPY;
+		if (send_frame(port, STUB_COMMIT, payload, sizeof(payload)))
+			return -1;
+		r = get_reply(port, STUB_COMMIT,
+			      n / PAGE_SIZE * WRITE_TIME + READ_TIME, &seq);
+		if (r < 0)
+			return -1;
+		if (r == ERROR_TIMEOUT || r == ERROR_INVALID_VALUE ||
+		    r == STUB_BAD_FRAME || r == STUB_BAD_DATA ||
+		    (r == 0 && seq != port->seq)) {
+			if (debug)
+				message(port, "Window resent (%d)\n", r);
+			continue;
+		}
+		if (r) {
+			print_status(port, r);
+			return -1;
+		}
+		port->seq = (port->seq + 1) & 0xff;
+		return 0;
+	}
+	error_message(port, "stub: no valid reply\n");
+	return -1;
+}
+
+/* Frames answered by a status (and data) only */
+static int request(struct port *port, int type, uint8_t *payload, int len,
+		   int busy, char *data, int size)
+{
+	int i;
+	int r;
+
+	for (i = 0; i < RETRY; i++) {
+		if (i) {
+			trace_retry(port);
+			flush_input(port);
+		}
+		if (send_frame(port, type, payload, len))
+			return -1;
+		r = get_reply(port, type, busy, NULL);
+		if (r < 0)
+			return -1;
+		if (r == ERROR_TIMEOUT || r == ERROR_INVALID_VALUE)
+			continue;
+		if (r) {
+			print_status(port, r);
+			return -1;
+		}
+		if (size && com_read(port, data, size))
+			return -1;
+		return 0;
+	}
+	error_message(port, "stub: no reply (%c)\n", type);
+	return -1;
+}
+
+static int stub_crc(struct port *port, uint32_t addr, int n, uint32_t *crc)
+{
+	uint8_t payload[6];
+	uint8_t d[4];
+
+	put32(&payload[0], addr);
+	put16(&payload[4], n);
+	if (request(port, STUB_VERIFY, payload, sizeof(payload),
+		    (n + SECTOR_SIZE - 1) / SECTOR_SIZE * READ_TIME,
+		    (char *)d, 4))
+		return -1;
+	*crc = d[0] | d[1] << 8 | d[2] << 16 | (uint32_t)d[3] << 24;
+	return 0;
+}
+
+static int stub_erase(struct port *port, int start, int end)
+{
+	uint8_t payload[2];
+
+	if (debug)
+		message(port, "Erase %d-%d\n", start, end);
+	payload[0] = start;
+	payload[1] = end;
+	return request(port, STUB_ERASE, payload, sizeof(payload),
+		       (end - start + 1) * ERASE_TIME, NULL, 0);
+}
+
+/*
+ * Download through the stub: each run of sectors that contain data (and
+ * have changed, with incremental) is erased at once and sent in windows.
+ */
+int stub_download(struct port *port, struct image *image)
+{
+	bool write[IMAGE_SECTORS];
+	uint8_t payload[6];
+	uint8_t crp[4];
+	int sector;
+	int sectors;
+	int skipped;
+	int written;
+	int start;
+	uint32_t addr;
+	int n;
+	int m;
+	uint32_t w;
+
+	if (image->end[0])
+		message(port, "Checksum = 0x%08x\n", image->checksum);
+
+	sectors = 0;
+	skipped = 0;
+	written = 0;
+	for (sector = 0; sector < IMAGE_SECTORS; sector++) {
+		write[sector] = image->end[sector] != 0;
+		if (!write[sector])
+			continue;
+		sectors++;
+		if (incremental) {
+			port->phase = PHASE_VERIFY;
+			if (stub_crc(port, FLASH_ADDRESS + sector * SECTOR_SIZE,
+				     SECTOR_SIZE, &w))
+				return -1;
+			if (w == crc32(&image->data[sector * SECTOR_SIZE],
+				       SECTOR_SIZE)) {
+				if (debug)
+					message(port, "Sector %d unchanged\n",
+						sector);
+				write[sector] = false;
+				skipped++;
+				continue;
+			}
+		}
+		written += image->end[sector];
+	}
+
+	for (sector = 0; sector < IMAGE_SECTORS; sector++) {
+		if (!write[sector])
+			continue;
+		for (start = sector; sector + 1 < IMAGE_SECTORS &&
+			     write[sector + 1]; sector++)
+			;
+
+		port->phase = PHASE_ERASE;
+		if (stub_erase(port, start, sector))
+			return -1;
+
+		addr = start * SECTOR_SIZE;
+		n = sector * SECTOR_SIZE + ((image->end[sector] + PAGE_SIZE - 1)
+					    & ~(PAGE_SIZE - 1));
+		while (addr < n) {
+			m = n - addr > port->window ? port->window : n - addr;
+			if (write_window(port, FLASH_ADDRESS + addr,
+					 &image->data[addr], m))
+				return -1;
+			addr += m;
+		}
+	}
+
+	/* Check Code Read Protection */
+	port->phase = PHASE_VERIFY;
+	put32(&payload[0], CRP);
+	put16(&payload[4], 4);
+	if (request(port, STUB_READ, payload, sizeof(payload), 0,
+		    (char *)crp, 4))
+		return -1;
+	print_crp(port, crp[0] | crp[1] << 8 | crp[2] << 16 |
+		  (uint32_t)crp[3] << 24);
+
+	if (incremental)
+		message(port, "%d of %d sectors unchanged\n", skipped,
+			sectors);
+	message(port, "wrote %d bytes\n", written);
+	return written;
+}
@@ -0,0 +1,33 @@
+/*
+ * loader.h
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define STUB_IMAGE_SIZE	0x400	/* body and loader (stub/stub.x) */
+
+/* stub.bin */
+struct stub_image {
+	uint8_t data[STUB_IMAGE_SIZE];
+	int body;		/* size of the body */
+	int loader;		/* size of the loader */
+};
+
+int stub_load(struct stub_image *stub, char *fname);
+int stub_start(struct port *port, struct stub_image *stub, int max_baud);
+int stub_download(struct port *port, struct image *image);
@@ -30,14 +30,48 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <strings.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "command.h"
+#include "image.h"
 #include "transfer.h"
+#include "baud.h"
+#include "trace.h"
+#include "loader.h"
+#include "patch.h"
+#include "session.h"
+#include "daemon.h"
 
-#define RETRY 10
+#define MAX_DEVICES 32
 
 bool debug;
-int sram_size = 1024;
+bool crc_verify;
+bool incremental;
+
+/* Options */
+static speed_t baudrate = B115200;
+static int baud = 115200;
+static int max_baud;
+static struct request req = {-1};
+static int size = 256;
+static char *trace_file;
+static struct image image;
+static char *stub_file;
+static struct stub_image stub;
+static char *serve_path;
+static char *submit_path;
+static struct patch patch[MAX_PATCHES];
+
+/* One job per device */
+struct job {
+	struct session s;
+	struct trace trace;
+	pthread_t thread;
+	int result;
+	int bytes;
+	double elapsed;
+};
 
 static struct {
 	char *name;
@@ -51,54 +85,120 @@ static struct {
 	{0, 0}
 };
 
-static struct {
-	uint32_t pid;
-	char *dev_name;
-	int sram;
-} device_table[] = {
-	{PID_LPC810M021FN8, "LPC810M021FN8", 1024},
-	{PID_LPC811M001JDH16, "LPC811M001JDH16", 2048},
-	{PID_LPC812M101JDH16, "LPC812M101JDH16", 4096},
-	{PID_LPC812M101JD20, "LPC812M101JD20", 4096},
-	{PID_LPC812M101JDH20, "LPC812M101JDH20/JTB16", 4096},
-	{0, NULL, 0}
-};
-
 static void usage(char *prog)
 {
 	printf("Usage: %s [options]\n", prog);
 	printf("  -h\t\tPrint this message\n");
 	printf("  -v\t\tPrint verbose debug statements\n");
 	printf("  -d <dev>\tSpecify USART device (default: /dev/ttyUSB0)\n");
+	printf("\t\tRepeat -d to program several devices in parallel\n");
 	printf("  -b <baud>\tSpecify baud rate (default: 115200)\n");
+	printf("  -B <baud>\tSwitch to the fastest baud rate up to <baud> "
+	       "after\n\t\tsynchronization (ISP: up to 115200; "
+	       "stub: see -L)\n");
 	printf("  -t <bytes>\tSpecify the number of upload transfer bytes\n");
 	printf("  -U <file>\tRead firmware from device into file\n");
-	printf("  -D <file>\tWrite firmware from file into device\n");
+	printf("  -C <addr>,<bytes>\n\t\tRead the CRC checksum of memory\n");
+	printf("  -u\t\tRead the unique ID\n");
+	printf("  -D <file>\tWrite firmware from file into device\n"
+	       "\t\t(binary, ELF, Intel HEX or S-record)\n");
+	printf("  -P <patch>\tPut data of each device into the image "
+	       "(repeatable):\n"
+	       "\t\t<addr>,hex,<bytes>  <addr>,file,<file>\n"
+	       "\t\t<addr>,counter,<file>  <addr>,uid\n");
+	printf("  -c\t\tVerify by CRC checksum instead of reading back\n");
+	printf("  -i\t\tSkip sectors whose contents are unchanged\n");
+	printf("  -L <file>\tDownload through the flash stub in file "
+	       "(stub/stub.bin)\n");
+	printf("  -T <file>\tRecord the timing of each ISP command into file\n"
+	       "\t\t(JSON if it ends with .json, CSV otherwise)\n");
+	printf("  -S <socket>\tKeep the devices synchronized and run the "
+	       "jobs sent to\n\t\tsocket (daemon)\n");
+	printf("  -s <socket>\tSend the job to the daemon on socket\n");
+}
+
+/* Run a job on one device. */
+static void *worker(void *arg)
+{
+	struct job *job = arg;
+	struct session *s = &job->s;
+	struct port *port = &s->port;
+	struct image *image;
+	struct timespec start;
+	struct timespec end;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->result = -1;
+	if (trace_file && !trace_init(&job->trace))
+		port->trace = &job->trace;
+
+	if (session_open(s))
+		return NULL;
+
+	/* Transfer data. */
+	if (req.type == JOB_DOWNLOAD && stub_file) {
+		image = session_image(s, &req);
+		if (image == NULL)
+			goto ioerror;
+		r = -1;
+		if (!stub_start(port, &stub, max_baud))
+			r = stub_download(port, image);
+		if (image != req.image)
+			free(image);
+	} else {
+		r = session_run(s, &req);
+	}
+	if (r < 0)
+		goto ioerror;
+	job->bytes = r;
+	trace_summary(port);
+
+	if (session_close(s))
+		return NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	job->result = 0;
+	return NULL;
+
+ioerror:
+	session_close(s);
+	return NULL;
 }
 
 int main(int argc, char *argv[])
 {
 	int opt;
 	int i;
-	speed_t baudrate = B115200;
-	bool download_flag = false;
-	char *fname = NULL;
-	char *usart = "/dev/ttyUSB0";
-	int size = 256;
-	bool upload_flag = false;
+	char *usart[MAX_DEVICES];
+	int ndev = 0;
+	struct job *job;
+	int failed;
 	FILE *stream;
-	int fd;
-	struct termios oldtio;
-	struct termios newtio;
-	uint8_t version[2];
-	uint32_t pid;
+	bool json;
+	int n;
+	int njob = 0;
+	char *p;
+	struct session *s;
 
-	while ((opt = getopt(argc, argv, "b:D:d:ht:U:v")) != -1) {
+	while ((opt = getopt(argc, argv, "B:b:C:cD:d:hiL:P:S:s:T:t:U:uv"))
+	       != -1) {
 		switch (opt) {
+		case 'B':
+			max_baud = atoi(optarg);
+			if (max_baud <= 0) {
+				fprintf(stderr, "Invalid baud rate (%s).\n",
+					optarg);
+				return 1;
+			}
+			break;
 		case 'b':
 			for (i = 0; baud_table[i].name; i++) {
 				if (strcmp(optarg, baud_table[i].name) == 0) {
 					baudrate = baud_table[i].speed;
+					baud = atoi(baud_table[i].name);
 					break;
 				}
 			}
@@ -108,22 +208,71 @@ int main(int argc, char *argv[])
 				return 1;
 			}
 			break;
+		case 'C':
+			req.type = JOB_CRC;
+			req.addr = strtoul(optarg, &p, 0);
+			if (*p == ',')
+				req.bytes = strtol(p + 1, &p, 0);
+			if (*p || req.bytes <= 0) {
+				fprintf(stderr, "Invalid range (%s).\n",
+					optarg);
+				return 1;
+			}
+			njob++;
+			break;
+		case 'c':
+			crc_verify = true;
+			break;
 		case 'D':
-			download_flag = true;
-			fname = optarg;
+			req.type = JOB_DOWNLOAD;
+			req.fname = optarg;
+			njob++;
 			break;
 		case 'd':
-			usart = optarg;
+			if (ndev >= MAX_DEVICES) {
+				fprintf(stderr, "Too many devices.\n");
+				return 1;
+			}
+			usart[ndev++] = optarg;
 			break;
 		case 'h':
 			usage(argv[0]);
 			return 0;
+		case 'i':
+			incremental = true;
+			break;
+		case 'L':
+			stub_file = optarg;
+			break;
+		case 'P':
+			if (req.npatch >= MAX_PATCHES) {
+				fprintf(stderr, "Too many patches.\n");
+				return 1;
+			}
+			if (patch_parse(&patch[req.npatch], optarg, stderr))
+				return 1;
+			req.npatch++;
+			break;
+		case 'S':
+			serve_path = optarg;
+			break;
+		case 's':
+			submit_path = optarg;
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
 		case 't':
 			size = atoi(optarg);
 			break;
 		case 'U':
-			upload_flag = true;
-			fname = optarg;
+			req.type = JOB_UPLOAD;
+			req.fname = optarg;
+			njob++;
+			break;
+		case 'u':
+			req.type = JOB_UID;
+			njob++;
 			break;
 		case 'v':
 			debug = true;
@@ -134,121 +283,142 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if ((download_flag && upload_flag) ||
-	    (!download_flag && !upload_flag)) {
-		fprintf(stderr, "You need to specify one of -D or -U\n");
+	if (serve_path) {
+		if (njob || submit_path || stub_file || trace_file) {
+			fprintf(stderr, "-S can't be used with -D, -U, -C, "
+				"-u, -s, -L or -T\n");
+			return 1;
+		}
+	} else if (njob != 1) {
+		fprintf(stderr, "You need to specify one of -D, -U, -C or "
+			"-u\n");
 		return 1;
 	}
-
-	/* Open data file. */
-	if (download_flag)
-		stream = fopen(fname, "r");
-	else
-		stream = fopen(fname, "w");
-	if (stream == NULL) {
-		perror(fname);
+	if (submit_path && (stub_file || trace_file)) {
+		fprintf(stderr, "-s can't be used with -L or -T\n");
 		return 1;
 	}
-
-	/* Open serial port. */
-	fd = open(usart, O_RDWR | O_NOCTTY);
-	if (fd < 0) {
-		perror(usart);
-		fclose(stream);
+	if (req.npatch && req.type != JOB_DOWNLOAD) {
+		fprintf(stderr, "-P can only be used with -D\n");
 		return 1;
 	}
+	req.image = &image;
+	req.patch = patch;
+	if (req.type == JOB_UPLOAD)
+		req.bytes = size;
+
+	/* Hand the job to the daemon. */
+	if (submit_path)
+		return submit(submit_path, &req, usart, ndev);
 
-	if (tcgetattr(fd, &oldtio)) {
-		perror("tcgetattr() failed");
-		close(fd);
-		fclose(stream);
+	if (ndev == 0)
+		usart[ndev++] = "/dev/ttyUSB0";
+	if (ndev > 1 && req.type == JOB_UPLOAD) {
+		fprintf(stderr, "-U can't be used with several devices\n");
 		return 1;
 	}
 
-	bzero(&newtio, sizeof(newtio));
-	newtio.c_cflag = baudrate | CS8 | CLOCAL | CREAD;
-	newtio.c_iflag = IGNPAR;
-	newtio.c_oflag = 0;
-
-	newtio.c_lflag = 0;
-
-	newtio.c_cc[VTIME] = 5;
-	newtio.c_cc[VMIN] = 0;
+	/* Load the image (shared by all jobs). */
+	if (req.type == JOB_DOWNLOAD && image_load(&image, req.fname, stderr))
+		return 1;
+	if (req.type == JOB_DOWNLOAD && stub_file &&
+	    stub_load(&stub, stub_file))
+		return 1;
 
-	if (tcflush(fd, TCIFLUSH)) {
-		perror("tcflush() failed");
-		close(fd);
-		fclose(stream);
+	job = calloc(ndev, sizeof(struct job));
+	if (job == NULL) {
+		perror("calloc() failed");
 		return 1;
 	}
-	if (tcsetattr(fd, TCSANOW, &newtio)) {
-		perror("tcsetattr() failed");
-		close(fd);
-		fclose(stream);
-		return 1;
+	for (i = 0; i < ndev; i++) {
+		s = &job[i].s;
+		s->usart = usart[i];
+		s->speed = baudrate;
+		s->baud = baud;
+		/* The stub sets its own baud rate. */
+		if (!(req.type == JOB_DOWNLOAD && stub_file))
+			s->max_baud = max_baud;
+		if (ndev > 1)
+			s->port.name = usart[i];
 	}
 
-	/* ISP initialization */
-	if (isp_init(fd, RETRY))
-		goto ioerror;
-
-	/* Echo off */
-	if (echo(fd, 0))
-		goto ioerror;
-
-	/* Read ISP version */
-	if (read_boot_code_version(fd, version))
-		goto ioerror;
-	printf("ISP version %d.%d\n", version[1], version[0]);
-
-	/* Read PID */
-	if (read_part_id(fd, &pid))
-		goto ioerror;
-	printf("PID 0x%x  ", pid);
-	for (i = 0; device_table[i].dev_name; i++) {
-		if (device_table[i].pid == pid) {
-			printf("%s\n", device_table[i].dev_name);
-			sram_size = device_table[i].sram;
-			break;
+	/* Daemon: the sessions stay open until a signal. */
+	if (serve_path) {
+		s = calloc(ndev, sizeof(struct session));
+		if (s == NULL) {
+			perror("calloc() failed");
+			free(job);
+			return 1;
 		}
+		for (i = 0; i < ndev; i++)
+			s[i] = job[i].s;
+		free(job);
+		failed = serve(serve_path, s, ndev);
+		free(s);
+		return failed;
 	}
-	if (!device_table[i].dev_name)
-		printf("unknown device\n");
 
-	/* Transfer data. */
-	if (upload_flag) {
-		if (upload(fd, stream, size) < 0)
-			goto ioerror;
-	}
-	if (download_flag) {
-		if (download(fd, stream) < 0)
-			goto ioerror;
-	}
+	if (ndev == 1) {
+		worker(&job[0]);
+	} else {
+		/* Gang programming: one thread per device */
+		for (i = 0; i < ndev; i++) {
+			if (pthread_create(&job[i].thread, NULL, worker,
+					   &job[i])) {
+				fprintf(stderr, "pthread_create() failed\n");
+				return 1;
+			}
+		}
+		for (i = 0; i < ndev; i++)
+			pthread_join(job[i].thread, NULL);
 
-	/* Close serial port. */
-	if (tcsetattr(fd, TCSANOW, &oldtio)) {
-		perror("tcsetattr() failed");
-		close(fd);
-		fclose(stream);
-		return 1;
-	}
-	if (close(fd)) {
-		perror("close() failed");
-		fclose(stream);
-		return 1;
+		/* Summary */
+		printf("\n");
+		for (i = 0; i < ndev; i++) {
+			s = &job[i].s;
+			if (job[i].result)
+				printf("%-16s FAILED\n", s->usart);
+			else
+				printf("%-16s OK      %-21s %6d bytes "
+				       "%6.2f s\n", s->usart,
+				       s->dev_name ? s->dev_name :
+				       "unknown device",
+				       job[i].bytes, job[i].elapsed);
+		}
 	}
 
-	/* Close data file. */
-	if (fclose(stream)) {
-		perror("fclose() failed");
-		return 1;
+	failed = 0;
+	for (i = 0; i < ndev; i++) {
+		if (job[i].result)
+			failed++;
 	}
 
-	return 0;
+	/* Timing records */
+	if (trace_file) {
+		stream = fopen(trace_file, "w");
+		if (stream == NULL) {
+			perror(trace_file);
+			failed++;
+		} else {
+			n = strlen(trace_file);
+			json = n >= 5 && !strcmp(trace_file + n - 5, ".json");
+			trace_header(stream, json);
+			n = 0;
+			for (i = 0; i < ndev; i++) {
+				if (job[i].trace.rec == NULL)
+					continue;
+				n = trace_write(stream, json, job[i].s.usart,
+						&job[i].trace, n);
+				trace_free(&job[i].trace);
+			}
+			trace_footer(stream, json);
+			if (fclose(stream)) {
+				perror("fclose() failed");
+				failed++;
+			}
+		}
+	}
+	free(job);
 
-ioerror:
-	tcsetattr(fd, TCSANOW, &oldtio);
-	close(fd);
-	fclose(stream);
-	return 1;
+	return failed ? 1 : 0;
 }
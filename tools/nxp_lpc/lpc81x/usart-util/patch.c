@@ -0,0 +1,289 @@
+/*
+ * patch.c
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-device data (serial numbers, calibration, keys) is written into a
+ * copy of the image before it is programmed, and the checksum of the
+ * vector table is computed again.  Numbers and UID words are stored
+ * little-endian.
+ *
+ *	<addr>,hex,<bytes>	e.g. 0x3f00,hex,0102a0ff
+ *	<addr>,file,<file>	contents of file
+ *	<addr>,counter,<file>	the number in file (then incremented)
+ *	<addr>,uid		UID read from the device
+ *
+ * The counter file is locked while the number is taken, so devices
+ * programmed at the same time get different numbers.  A number is not
+ * given back if programming fails.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "command.h"
+#include "image.h"
+#include "transfer.h"
+#include "trace.h"
+#include "patch.h"
+
+static char *type_name[] = {"hex", "file", "counter", "uid"};
+
+static void put32(uint8_t *p, uint32_t w)
+{
+	p[0] = w & 0xff;
+	p[1] = w >> 8 & 0xff;
+	p[2] = w >> 16 & 0xff;
+	p[3] = w >> 24;
+}
+
+static int parse_hex(struct patch *patch, FILE *err)
+{
+	char *s = patch->arg;
+	int n;
+	int i;
+	char c[3];
+
+	n = strlen(s);
+	if (n == 0 || n % 2)
+		return -1;
+	patch->data = malloc(n / 2);
+	if (patch->data == NULL) {
+		fprintf(err, "malloc() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	c[2] = '\0';
+	for (i = 0; i < n / 2; i++) {
+		c[0] = s[i * 2];
+		c[1] = s[i * 2 + 1];
+		if (!isxdigit((unsigned char)c[0]) ||
+		    !isxdigit((unsigned char)c[1]))
+			return -1;
+		patch->data[i] = strtoul(c, NULL, 16);
+	}
+	patch->bytes = n / 2;
+	return 0;
+}
+
+static int read_file(struct patch *patch, FILE *err)
+{
+	FILE *stream;
+	int n;
+
+	stream = fopen(patch->arg, "r");
+	if (stream == NULL) {
+		fprintf(err, "%s: %s\n", patch->arg, strerror(errno));
+		return -1;
+	}
+	patch->data = malloc(IMAGE_SIZE + 1);
+	if (patch->data == NULL) {
+		fprintf(err, "malloc() failed: %s\n", strerror(errno));
+		fclose(stream);
+		return -1;
+	}
+	n = fread(patch->data, 1, IMAGE_SIZE + 1, stream);
+	if (ferror(stream)) {
+		fprintf(err, "%s: %s\n", patch->arg, strerror(errno));
+		fclose(stream);
+		return -1;
+	}
+	fclose(stream);
+	if (n == 0 || n > IMAGE_SIZE) {
+		fprintf(err, "%s: %s\n", patch->arg,
+			n ? "too large" : "empty file");
+		return -1;
+	}
+	patch->bytes = n;
+	return 0;
+}
+
+/*
+ * Parse a descriptor, and read its data (except for counter and uid).
+ * Errors are written to err.
+ */
+int patch_parse(struct patch *patch, const char *s, FILE *err)
+{
+	char *p;
+
+	memset(patch, 0, sizeof(*patch));
+	patch->desc = strdup(s);
+	if (patch->desc == NULL) {
+		fprintf(err, "strdup() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	patch->addr = strtoul(patch->desc, &p, 0);
+	if (p == patch->desc || *p != ',')
+		goto invalid;
+	patch->name = p + 1;
+	p = strchr(patch->name, ',');
+	if (p) {
+		*p = '\0';
+		patch->arg = p + 1;
+	}
+	for (patch->type = 0; patch->type <= PATCH_UID; patch->type++) {
+		if (!strcmp(patch->name, type_name[patch->type]))
+			break;
+	}
+
+	switch (patch->type) {
+	case PATCH_HEX:
+		if (patch->arg == NULL || parse_hex(patch, err))
+			goto invalid;
+		break;
+	case PATCH_FILE:
+		if (patch->arg == NULL)
+			goto invalid;
+		if (read_file(patch, err))
+			goto error;
+		break;
+	case PATCH_COUNTER:
+		if (patch->arg == NULL)
+			goto invalid;
+		patch->bytes = 4;
+		break;
+	case PATCH_UID:
+		if (patch->arg)
+			goto invalid;
+		patch->bytes = UID_WORDS * 4;
+		break;
+	default:
+		goto invalid;
+	}
+
+	if (patch->addr < FLASH_ADDRESS || patch->bytes > IMAGE_SIZE ||
+	    patch->addr - FLASH_ADDRESS > IMAGE_SIZE - patch->bytes) {
+		fprintf(err, "Patch out of flash (%s).\n", s);
+		goto error;
+	}
+	return 0;
+
+invalid:
+	fprintf(err, "Invalid patch (%s).\n", s);
+error:
+	patch_free(patch);
+	return -1;
+}
+
+void patch_free(struct patch *patch)
+{
+	free(patch->data);
+	free(patch->desc);
+	patch->data = NULL;
+	patch->desc = NULL;
+}
+
+/* Take the number in a counter file and write the next one. */
+static int take_number(struct port *port, char *fname, uint32_t *number)
+{
+	char buf[32];
+	char *p;
+	int fd;
+	int n;
+
+	fd = open(fname, O_RDWR);
+	if (fd < 0) {
+		error_message(port, "%s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if (flock(fd, LOCK_EX)) {
+		error_message(port, "flock() failed: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	if (n < 0) {
+		error_message(port, "%s: %s\n", fname, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	buf[n] = '\0';
+	*number = strtoul(buf, &p, 0);
+	if (p == buf || (*p && !isspace((unsigned char)*p))) {
+		error_message(port, "%s: invalid number\n", fname);
+		close(fd);
+		return -1;
+	}
+
+	n = sprintf(buf, "%u\n", *number + 1);
+	if (lseek(fd, 0, SEEK_SET) || ftruncate(fd, 0) ||
+	    write(fd, buf, n) != n) {
+		error_message(port, "%s: %s\n", fname, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (close(fd)) {
+		error_message(port, "close() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Apply the patches to the image of the device on port. */
+int patch_apply(struct port *port, struct image *image, struct patch *patch,
+		int n)
+{
+	struct patch *p;
+	uint8_t buf[UID_WORDS * 4];
+	uint32_t uid[UID_WORDS];
+	uint32_t number;
+	uint8_t *data;
+	int i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		p = &patch[i];
+		switch (p->type) {
+		case PATCH_COUNTER:
+			if (take_number(port, p->arg, &number))
+				return -1;
+			put32(buf, number);
+			data = buf;
+			message(port, "Patch 0x%08x: %u\n", p->addr, number);
+			break;
+		case PATCH_UID:
+			port->phase = PHASE_READ;
+			if (read_uid(port, uid))
+				return -1;
+			for (j = 0; j < UID_WORDS; j++)
+				put32(&buf[j * 4], uid[j]);
+			data = buf;
+			message(port, "Patch 0x%08x: UID\n", p->addr);
+			break;
+		default:
+			data = p->data;
+			message(port, "Patch 0x%08x: %d bytes\n", p->addr,
+				p->bytes);
+			break;
+		}
+		if (image_patch(image, p->addr, data, p->bytes,
+				port->out ? port->out : stderr))
+			return -1;
+	}
+	return 0;
+}
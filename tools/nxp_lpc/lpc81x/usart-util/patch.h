@@ -0,0 +1,46 @@
+/*
+ * patch.h
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define MAX_PATCHES	16
+
+/* Types */
+enum {
+	PATCH_HEX,		/* bytes in hex */
+	PATCH_FILE,		/* contents of a file */
+	PATCH_COUNTER,		/* 32-bit number taken from a file */
+	PATCH_UID		/* UID of the device (16 bytes) */
+};
+
+/* Data written into the image of each device: <addr>,<type>[,<arg>] */
+struct patch {
+	uint32_t addr;
+	int type;
+	char *desc;		/* copy of the descriptor */
+	char *name;		/* type name (in desc) */
+	char *arg;		/* file name or hex (in desc) */
+	uint8_t *data;		/* PATCH_HEX, PATCH_FILE */
+	int bytes;
+};
+
+int patch_parse(struct patch *patch, const char *s, FILE *err);
+void patch_free(struct patch *patch);
+int patch_apply(struct port *port, struct image *image, struct patch *patch,
+		int n);
@@ -0,0 +1,263 @@
+/*
+ * session.c
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "command.h"
+#include "image.h"
+#include "transfer.h"
+#include "baud.h"
+#include "trace.h"
+#include "patch.h"
+#include "session.h"
+
+#define RETRY 10
+
+static struct {
+	uint32_t pid;
+	char *dev_name;
+	int sram;
+} device_table[] = {
+	{PID_LPC810M021FN8, "LPC810M021FN8", 1024},
+	{PID_LPC811M001JDH16, "LPC811M001JDH16", 2048},
+	{PID_LPC812M101JDH16, "LPC812M101JDH16", 4096},
+	{PID_LPC812M101JD20, "LPC812M101JD20", 4096},
+	{PID_LPC812M101JDH20, "LPC812M101JDH20/JTB16", 4096},
+	{0, NULL, 0}
+};
+
+/* Open the serial port and synchronize with the ISP. */
+int session_open(struct session *s)
+{
+	struct port *port = &s->port;
+	struct termios newtio;
+
+	port->fd = open(s->usart, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (port->fd < 0) {
+		perror(s->usart);
+		return -1;
+	}
+
+	if (tcgetattr(port->fd, &s->oldtio)) {
+		perror("tcgetattr() failed");
+		close(port->fd);
+		return -1;
+	}
+
+	bzero(&newtio, sizeof(newtio));
+	newtio.c_cflag = s->speed | CS8 | CLOCAL | CREAD;
+	newtio.c_iflag = IGNPAR;
+	newtio.c_oflag = 0;
+
+	newtio.c_lflag = 0;
+
+	/* Timeouts are handled in command.c. */
+	newtio.c_cc[VTIME] = 0;
+	newtio.c_cc[VMIN] = 0;
+
+	if (tcflush(port->fd, TCIFLUSH)) {
+		perror("tcflush() failed");
+		close(port->fd);
+		return -1;
+	}
+	if (tcsetattr(port->fd, TCSANOW, &newtio)) {
+		perror("tcsetattr() failed");
+		close(port->fd);
+		return -1;
+	}
+	port->baud = s->baud;
+
+	if (session_sync(s)) {
+		tcsetattr(port->fd, TCSANOW, &s->oldtio);
+		close(port->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/* Synchronize with the ISP of a device that has just been reset. */
+int session_sync(struct session *s)
+{
+	struct port *port = &s->port;
+	uint8_t version[2];
+	int rate;
+	int i;
+
+	port->sram_size = 1024;
+	port->echo_disable = false;
+	if (port->baud != s->baud && set_line_speed(port, s->baud))
+		return -1;
+	flush_input(port);
+
+	/* ISP initialization */
+	if (isp_init(port, RETRY))
+		return -1;
+
+	/* Echo off */
+	if (echo(port, 0))
+		return -1;
+
+	/* Baud rate negotiation */
+	if (s->max_baud > s->baud) {
+		rate = negotiate_baud_rate(port, s->baud, s->max_baud);
+		if (rate < 0)
+			return -1;
+		message(port, "Baud rate %d\n", rate);
+	}
+
+	/* Read ISP version */
+	if (read_boot_code_version(port, version))
+		return -1;
+	message(port, "ISP version %d.%d\n", version[1], version[0]);
+
+	/* Read PID */
+	if (read_part_id(port, &s->pid))
+		return -1;
+	s->dev_name = NULL;
+	for (i = 0; device_table[i].dev_name; i++) {
+		if (device_table[i].pid == s->pid) {
+			s->dev_name = device_table[i].dev_name;
+			port->sram_size = device_table[i].sram;
+			break;
+		}
+	}
+	message(port, "PID 0x%x  %s\n", s->pid,
+		s->dev_name ? s->dev_name : "unknown device");
+	return 0;
+}
+
+/*
+ * Check that the device is still in the session (one 'J' command), and
+ * synchronize again if it has been reset or replaced.
+ */
+int session_check(struct session *s)
+{
+	struct port *port = &s->port;
+	uint32_t pid;
+
+	flush_input(port);
+	if (!read_part_id(port, &pid) && pid == s->pid)
+		return 0;
+	message(port, "Resynchronizing\n");
+	return session_sync(s);
+}
+
+int session_close(struct session *s)
+{
+	struct port *port = &s->port;
+
+	if (tcsetattr(port->fd, TCSANOW, &s->oldtio)) {
+		perror("tcsetattr() failed");
+		close(port->fd);
+		return -1;
+	}
+	if (close(port->fd)) {
+		perror("close() failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Image for the device: a copy with the patches of the request, or the
+ * image of the request itself.  Return NULL on error.
+ */
+struct image *session_image(struct session *s, struct request *req)
+{
+	struct image *image;
+
+	if (req->npatch == 0)
+		return req->image;
+	image = malloc(sizeof(struct image));
+	if (image == NULL) {
+		error_message(&s->port, "malloc() failed\n");
+		return NULL;
+	}
+	*image = *req->image;
+	if (patch_apply(&s->port, image, req->patch, req->npatch)) {
+		free(image);
+		return NULL;
+	}
+	return image;
+}
+
+/* Return the number of bytes transferred, or -1. */
+int session_run(struct session *s, struct request *req)
+{
+	struct port *port = &s->port;
+	struct image *image;
+	FILE *stream;
+	uint32_t crc;
+	uint32_t uid[UID_WORDS];
+	int r;
+
+	switch (req->type) {
+	case JOB_DOWNLOAD:
+		image = session_image(s, req);
+		if (image == NULL)
+			return -1;
+		r = download(port, image);
+		if (image != req->image)
+			free(image);
+		return r;
+	case JOB_UPLOAD:
+		stream = fopen(req->fname, "w");
+		if (stream == NULL) {
+			error_message(port, "%s: %s\n", req->fname,
+				      strerror(errno));
+			return -1;
+		}
+		r = upload(port, stream, req->bytes);
+		if (fclose(stream)) {
+			error_message(port, "fclose() failed: %s\n",
+				      strerror(errno));
+			return -1;
+		}
+		return r;
+	case JOB_CRC:
+		port->phase = PHASE_VERIFY;
+		if (read_crc_checksum(port, req->addr, req->bytes, &crc))
+			return -1;
+		message(port, "CRC 0x%08x (0x%08x %d bytes)\n", crc,
+			req->addr, req->bytes);
+		return 0;
+	case JOB_UID:
+		port->phase = PHASE_READ;
+		if (read_uid(port, uid))
+			return -1;
+		message(port, "UID 0x%08x 0x%08x 0x%08x 0x%08x\n", uid[0],
+			uid[1], uid[2], uid[3]);
+		return 0;
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,57 @@
+/*
+ * session.h
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Synchronized ISP link to one device */
+struct session {
+	char *usart;		/* serial device */
+	struct port port;
+	struct termios oldtio;
+	speed_t speed;		/* of the auto-baud */
+	int baud;
+	int max_baud;		/* switch up to (0: stay at baud) */
+	uint32_t pid;
+	char *dev_name;
+};
+
+/* Jobs */
+enum {
+	JOB_DOWNLOAD,
+	JOB_UPLOAD,
+	JOB_CRC,
+	JOB_UID
+};
+
+struct request {
+	int type;
+	char *fname;		/* JOB_UPLOAD */
+	struct image *image;	/* JOB_DOWNLOAD */
+	struct patch *patch;	/* JOB_DOWNLOAD (per device) */
+	int npatch;
+	uint32_t addr;		/* JOB_CRC */
+	int bytes;		/* JOB_UPLOAD, JOB_CRC */
+};
+
+int session_open(struct session *s);
+int session_sync(struct session *s);
+int session_check(struct session *s);
+int session_close(struct session *s);
+int session_run(struct session *s, struct request *req);
+struct image *session_image(struct session *s, struct request *req);
@@ -0,0 +1,323 @@
+/*
+ * stub-check.c - Host test of the frame and LZ decoder of the flash stub
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * stub.c is built against the register model of the host library
+ * (liblpc81x-host.a): frames go in through the USART0 model and their
+ * CRC is checked by the CRC engine model.  Only STUB_DATA frames are
+ * run; the other ones call the IAP.
+ *
+ * The USART model holds 256 bytes, so a frame is fed whole only if its
+ * payload is at most 251 bytes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mmio_host.h>
+
+#include "stub.c"
+
+#define WINDOW		1024
+#define PAYLOAD_MAX	251
+
+static u8 window_buf[WINDOW];
+static u8 data[WINDOW + 64];
+
+/* Frame bytes for the next test */
+static u8 stream[16 * 1024];
+static int stream_len;
+
+/* Frame boundaries in stream */
+static int frame_start[256];
+static int nframes;
+
+static u16 crc_ccitt(const u8 *p, int n)
+{
+	u16 crc;
+	int i;
+
+	crc = 0xffff;
+	while (n--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = crc << 1 ^ (crc & 0x8000 ? 0x1021 : 0);
+	}
+	return crc;
+}
+
+static void add_frame(int type, const u8 *payload, int len)
+{
+	u8 *p = &stream[stream_len];
+	u16 crc;
+
+	frame_start[nframes++] = stream_len;
+	p[0] = STUB_SOF;
+	p[1] = type;
+	p[2] = len;
+	memcpy(&p[3], payload, len);
+	crc = crc_ccitt(&p[1], len + 2);
+	p[len + 3] = crc >> 8;
+	p[len + 4] = crc;
+	stream_len += len + 5;
+}
+
+/* Longest match for d[i] in d[0..i) (as loader.c) */
+static int find_match(const u8 *d, int i, int n, int *dist)
+{
+	int best;
+	int j;
+	int m;
+	int max;
+
+	max = n - i;
+	if (max > STUB_MATCH_MAX)
+		max = STUB_MATCH_MAX;
+	best = 0;
+	for (j = i - 1; j >= 0 && best < max; j--) {
+		for (m = 0; m < max && d[j + m] == d[i + m]; m++)
+			;
+		if (m > best) {
+			best = m;
+			*dist = i - j;
+		}
+	}
+	return best;
+}
+
+/* STUB_DATA frames of a window; matches of min or more bytes */
+static void encode(const u8 *d, int n, int min)
+{
+	u8 payload[PAYLOAD_MAX];
+	int len;
+	int lit;
+	int i;
+	int m;
+	int dist;
+
+	stream_len = 0;
+	nframes = 0;
+	i = 0;
+	while (i < n) {
+		payload[0] = i;
+		payload[1] = i >> 8;
+		len = 2;
+		lit = -1;
+		while (i < n) {
+			m = find_match(d, i, n, &dist);
+			if (m >= min) {
+				if (len + 3 > PAYLOAD_MAX)
+					break;
+				payload[len++] = 0x80 + m - STUB_MATCH_MIN;
+				payload[len++] = dist;
+				payload[len++] = dist >> 8;
+				i += m;
+				lit = -1;
+			} else if (lit < 0 || payload[lit] == 0x7f) {
+				if (len + 2 > PAYLOAD_MAX)
+					break;
+				lit = len;
+				payload[len++] = 0;
+				payload[len++] = d[i++];
+			} else {
+				if (len + 1 > PAYLOAD_MAX)
+					break;
+				payload[lit]++;
+				payload[len++] = d[i++];
+			}
+		}
+		add_frame(STUB_DATA, payload, len);
+	}
+}
+
+/* Run frames [first, last) of stream through the stub. */
+static void run(int first, int last)
+{
+	int from;
+	int to;
+
+	for (; first < last; first++) {
+		from = frame_start[first];
+		to = first + 1 < nframes ? frame_start[first + 1] :
+			stream_len;
+		mmio_host_usart_input(0, &stream[from], to - from);
+		frame();
+	}
+}
+
+static void start(void)
+{
+	buf = window_buf;
+	window = WINDOW;
+	count = 0;
+	bad = false;
+	memset(window_buf, 0, sizeof(window_buf));
+}
+
+/* Runs, repeats of earlier data and noise */
+static void fill(u8 *p, int n, u32 seed)
+{
+	u32 x = seed | 1;
+	u32 y = seed;
+	int i;
+	int k;
+
+	i = 0;
+	while (i < n) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		k = x % 3 == 0 ? x >> 8 & 0x7f : x >> 8 & 0xf;
+		for (; k >= 0 && i < n; k--, i++) {
+			switch (x >> 24 & 3) {
+			case 0:
+				p[i] = x >> 16;
+				break;
+			case 1:
+				p[i] = i > 300 ? p[i - 300 + (x >> 4 & 0xff)] :
+					x >> 16;
+				break;
+			case 2:
+				p[i] = x >> (i & 3) * 8;
+				break;
+			default:
+				y = y * 1103515245 + 12345;
+				p[i] = y >> 16;
+				break;
+			}
+		}
+	}
+}
+
+static int check_window(int n, int min, u32 seed)
+{
+	fill(data, n, seed);
+	encode(data, n, min);
+	start();
+	run(0, nframes);
+	if (bad || count != n || memcmp(window_buf, data, n)) {
+		printf("%d bytes (matches of %d): bad %d, count %d\n",
+		       n, min, bad, count);
+		return 1;
+	}
+	return 0;
+}
+
+/* A window that must be refused */
+static int check_bad(const char *name, bool expected)
+{
+	if (bad != expected) {
+		printf("%s: bad %d\n", name, bad);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	static const u8 zero_dist[] = {0, 0, 0, 'a', 0x80, 0, 0};
+	static const u8 far_dist[] = {0, 0, 1, 'a', 'b', 0x80, 3, 0};
+	static const u8 cut[] = {0, 0, 0, 'a', 0x80, 1};
+	static const u8 run_of[] = {0, 0, 0, 'x', 0xff, 1, 0};
+	int errors;
+	int n;
+
+	mmio_host_reset();
+	errors = 0;
+
+	/* Round trips */
+	for (n = 0; n <= WINDOW; n += 61)
+		errors += check_window(n, STUB_MATCH_MIN + 1, n);
+	errors += check_window(WINDOW, STUB_MATCH_MIN, 7);
+	errors += check_window(WINDOW, STUB_MATCH_MAX + 1, 8);
+
+	/* An overlapping match: a run of a byte */
+	stream_len = 0;
+	nframes = 0;
+	add_frame(STUB_DATA, run_of, sizeof(run_of));
+	start();
+	run(0, nframes);
+	if (bad || count != 1 + STUB_MATCH_MAX ||
+	    window_buf[0] != 'x' || window_buf[STUB_MATCH_MAX] != 'x') {
+		printf("run: bad %d, count %d\n", bad, count);
+		errors++;
+	}
+
+	/* A corrupted frame (literals only, so there are several) */
+	fill(data, WINDOW, 3);
+	encode(data, WINDOW, STUB_MATCH_MAX + 1);
+	stream[frame_start[1] + 5] ^= 0x10;
+	start();
+	run(0, nframes);
+	errors += check_bad("CRC error", true);
+
+	/* A lost frame */
+	encode(data, WINDOW, STUB_MATCH_MAX + 1);
+	start();
+	run(0, 1);
+	run(2, nframes);
+	errors += check_bad("lost frame", true);
+
+	/* The next window starts clean. */
+	run(0, nframes);
+	errors += check_bad("next window", false);
+	if (count != WINDOW || memcmp(window_buf, data, WINDOW)) {
+		printf("next window: count %d\n", count);
+		errors++;
+	}
+
+	/* More than the window */
+	fill(data, WINDOW + 64, 4);
+	encode(data, WINDOW + 64, STUB_MATCH_MIN + 1);
+	start();
+	run(0, nframes);
+	errors += check_bad("overflow", true);
+	if (count != WINDOW) {
+		printf("overflow: count %d\n", count);
+		errors++;
+	}
+
+	/* Invalid distances and a match cut by the end of the frame */
+	stream_len = 0;
+	nframes = 0;
+	add_frame(STUB_DATA, zero_dist, sizeof(zero_dist));
+	add_frame(STUB_DATA, far_dist, sizeof(far_dist));
+	add_frame(STUB_DATA, cut, sizeof(cut));
+	start();
+	run(0, 1);
+	errors += check_bad("distance 0", true);
+	start();
+	run(1, 2);
+	errors += check_bad("distance beyond the data", true);
+	start();
+	run(2, 3);
+	errors += check_bad("cut match", true);
+
+	/* Nothing may be left unread or sent. */
+	if (mmio_host_usart_output(0, data, 1) ||
+	    (USART0_STAT & USART_STAT_RXRDY)) {
+		printf("stray bytes\n");
+		errors++;
+	}
+
+	printf("%s\n", errors ? "failed" : "passed");
+	return errors != 0;
+}
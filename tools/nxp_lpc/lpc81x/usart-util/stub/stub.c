@@ -0,0 +1,346 @@
+/*
+ * stub.c - Flash stub loaded into SRAM by usart-util
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The stub takes over USART0 as the boot ROM left it (8N1, IRC) and
+ * calls the IAP directly, so it needs no library code and no startup:
+ * the body image includes .data and .bss, and the loader sets the stack.
+ * See stub.h for the protocol.
+ */
+
+#include <syscon.h>
+#include <usart.h>
+#include <crc.h>
+#include <flash_iap.h>
+
+#include "stub.h"
+
+#define CRC32_MODE	(CRC_MODE_CRC_POLY_CRC_32 | CRC_MODE_BIT_RVS_WR | \
+			 CRC_MODE_BIT_RVS_SUM | CRC_MODE_CMPL_SUM)
+#define ARG_SIZE	12
+
+extern u8 _body_start[];
+extern u8 _body_end[];
+
+void stub_loader(void) __attribute__ ((section (".loader"), noreturn));
+void stub_main(void) __attribute__ ((noreturn));
+
+static u8 *buf;			/* window buffer */
+static int window;		/* its size */
+static int count;		/* bytes decoded into it */
+static bool bad;		/* a frame of the window was lost */
+static int last_seq = -1;	/* last window programmed */
+static u8 arg[ARG_SIZE];	/* payload of frames other than STUB_DATA */
+
+#ifndef MMIO_HOST
+/*
+ * The boot ROM jumps here ('G').  No stack is used before it is moved
+ * out of the way of the body.  The host build (make check) has no loader.
+ */
+void stub_loader(void)
+{
+	u8 *p;
+
+	__asm__ __volatile__ ("cpsid i\n\tmsr msp, %0"
+			      : : "r" (STUB_STACK) : "memory");
+	for (p = _body_start; p < _body_end; p++) {
+		while (!(USART0_STAT & USART_STAT_RXRDY))
+			;
+		*p = USART0_RXDAT;
+	}
+	stub_main();
+}
+#endif
+
+/* The CRC engine checks every byte received. */
+static int recv(void)
+{
+	int c;
+
+	while (!(USART0_STAT & USART_STAT_RXRDY))
+		;
+	c = USART0_RXDAT & 0xff;
+	CRC_WR_DATA8 = c;
+	return c;
+}
+
+static void send(int c)
+{
+	while (!(USART0_STAT & USART_STAT_TXRDY))
+		;
+	USART0_TXDAT = c;
+}
+
+static void reply(int type, int status, int seq)
+{
+	send(STUB_SOF);
+	send(type);
+	send(status);
+	send(seq);
+}
+
+static u32 get16(const u8 *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static u32 get32(const u8 *p)
+{
+	return get16(p) | get16(p + 2) << 16;
+}
+
+static u32 crc32(const u8 *p, int n)
+{
+	CRC_MODE = CRC32_MODE;
+	CRC_SEED = 0xffffffff;
+	while (n--)
+		CRC_WR_DATA8 = *p++;
+	return CRC_SUM;
+}
+
+static int iap(u32 cmd0, u32 cmd1, u32 cmd2, u32 cmd3)
+{
+	unsigned int cmd[5];
+	unsigned int resp[4];
+
+	cmd[0] = cmd0;
+	cmd[1] = cmd1;
+	cmd[2] = cmd2;
+	cmd[3] = cmd3;
+	cmd[4] = STUB_CLOCK / 1000;
+	((IAP)IAP_LOCATION)(cmd, resp);
+	return resp[0];
+}
+
+static int erase(int start, int end)
+{
+	int r;
+
+	if (iap(IAP_BLANK_CHECK_SECTOR, start, end, 0) == IAP_CMD_SUCCESS)
+		return 0;
+	r = iap(IAP_PREPARE_SECTOR_FOR_WRITE_OPERATION, start, end, 0);
+	if (r)
+		return r;
+	return iap(IAP_ERASE_SECTOR, start, end, STUB_CLOCK / 1000);
+}
+
+/* Copy with the largest sizes (1024 ... 64) that fit and are aligned. */
+static int program(u32 addr, const u8 *p, int n)
+{
+	int size;
+	int r;
+
+	while (n > 0) {
+		for (size = IAP_SECTOR_SIZE; size > n || addr & (size - 1);
+		     size >>= 1)
+			;
+		r = iap(IAP_PREPARE_SECTOR_FOR_WRITE_OPERATION,
+			addr / IAP_SECTOR_SIZE,
+			(addr + size - 1) / IAP_SECTOR_SIZE, 0);
+		if (r)
+			return r;
+		r = iap(IAP_COPY_RAM_TO_FLASH, addr, (u32)p, size);
+		if (r)
+			return r;
+		addr += size;
+		p += size;
+		n -= size;
+	}
+	return 0;
+}
+
+static void put(int c)
+{
+	if (count < window)
+		buf[count++] = c;
+	else
+		bad = true;
+}
+
+/* Decode len bytes of LZ data. */
+static void decode(int len)
+{
+	int c;
+	int n;
+	int d;
+
+	while (len-- > 0) {
+		c = recv();
+		if (c < 0x80) {
+			for (n = c + 1; n > 0 && len > 0; n--, len--)
+				put(recv());
+			continue;
+		}
+		if (len < 2) {
+			while (len-- > 0)
+				recv();
+			bad = true;
+			return;
+		}
+		d = recv();
+		d |= recv() << 8;
+		len -= 2;
+		if (d == 0 || d > count) {
+			bad = true;
+			continue;
+		}
+		for (n = c - 0x80 + STUB_MATCH_MIN; n > 0; n--)
+			put(buf[count - d]);
+	}
+}
+
+static int commit(void)
+{
+	u32 addr;
+	int n;
+	u32 crc;
+
+	addr = get32(&arg[0]);
+	n = get16(&arg[4]);
+	crc = get32(&arg[8]);
+	if (bad || n != count)
+		return STUB_BAD_FRAME;
+	if (crc32(buf, n) != crc)
+		return STUB_BAD_DATA;
+	if (n % IAP_PAGE_SIZE || addr % IAP_PAGE_SIZE)
+		return STUB_INVALID;
+	n = program(addr, buf, n);
+	if (n)
+		return n;
+	if (crc32((const u8 *)addr, count) != crc)
+		return STUB_VERIFY_ERROR;
+	return STUB_OK;
+}
+
+/* Switch the baud rate after the reply has been sent. */
+static void setup(void)
+{
+	buf = (u8 *)get32(&arg[4]);
+	window = get16(&arg[8]);
+	count = 0;
+	reply(STUB_SETUP, STUB_OK, 0);
+	while (!(USART0_STAT & USART_STAT_TXIDLE))
+		;
+	SYSCON_UARTCLKDIV = 1;
+	SYSCON_UARTFRGDIV = 0xff;
+	SYSCON_UARTFRGMULT = arg[2];
+	USART0_BRG = get16(&arg[0]);
+}
+
+static void execute(int type)
+{
+	const u8 *p;
+	u32 crc;
+	int n;
+	int r;
+
+	switch (type) {
+	case STUB_SETUP:
+		setup();
+		break;
+	case STUB_ERASE:
+		reply(type, erase(arg[0], arg[1]), 0);
+		break;
+	case STUB_COMMIT:
+		/* The reply of the last window was lost. */
+		if (arg[6] == last_seq) {
+			r = STUB_OK;
+		} else {
+			r = commit();
+			if (r == STUB_OK)
+				last_seq = arg[6];
+		}
+		count = 0;
+		bad = false;
+		reply(type, r, arg[6]);
+		break;
+	case STUB_VERIFY:
+		crc = crc32((const u8 *)get32(&arg[0]), get16(&arg[4]));
+		reply(type, STUB_OK, 0);
+		for (n = 0; n < 32; n += 8)
+			send(crc >> n);
+		break;
+	case STUB_READ:
+		reply(type, STUB_OK, 0);
+		p = (const u8 *)get32(&arg[0]);
+		for (n = get16(&arg[4]); n > 0; n--)
+			send(*p++);
+		break;
+	default:
+		reply(type, STUB_INVALID, 0);
+		break;
+	}
+}
+
+/* Receive a frame and execute it. */
+static void frame(void)
+{
+	int type;
+	int len;
+	int i;
+
+	while (recv() != STUB_SOF)
+		;
+	CRC_MODE = CRC_MODE_CRC_POLY_CRC_CCITT;
+	CRC_SEED = 0xffff;
+	type = recv();
+	len = recv();
+	if (type == STUB_DATA) {
+		if (len < 2) {
+			bad = true;
+			return;
+		}
+		i = recv();
+		i |= recv() << 8;
+		if (i == 0) {
+			count = 0;
+			bad = false;
+		} else if (i != count) {
+			bad = true;
+		}
+		decode(len - 2);
+	} else {
+		for (i = 0; i < len; i++) {
+			if (i < ARG_SIZE)
+				arg[i] = recv();
+			else
+				recv();
+		}
+	}
+	/* The CRC of the frame itself leaves zero. */
+	recv();
+	recv();
+	if (CRC_SUM & 0xffff) {
+		bad = true;
+		return;
+	}
+	if (type != STUB_DATA)
+		execute(type);
+}
+
+void stub_main(void)
+{
+	SYSCON_SYSAHBCLKCTRL |= SYSCON_SYSAHBCLKCTRL_CRC;
+
+	reply(STUB_HELLO, STUB_OK, STUB_VERSION);
+	for (;;)
+		frame();
+}
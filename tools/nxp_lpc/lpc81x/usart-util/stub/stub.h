@@ -0,0 +1,100 @@
+/*
+ * stub.h - Flash stub protocol
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * stub.bin is a flat image of SRAM from 0x10000000.  The body (the stub
+ * itself) is at the bottom; the loader is at STUB_LOADER.  The first word
+ * of the loader is the size of the body, and its code starts at
+ * STUB_ENTRY.
+ *
+ * usart-util writes the loader with 'W' (the ISP accepts nothing below
+ * 0x10000300) and starts it with 'G'.  The loader receives the body in
+ * raw binary, and the body sends STUB_HELLO.  On the LPC810 the ISP stack
+ * takes all of the SRAM above 0x10000300, so the stub needs an LPC811 or
+ * LPC812; the window buffer is the SRAM above 1 KB.
+ *
+ * Frame (host to stub):
+ *	STUB_SOF, type, length, payload (length bytes), CRC (2 bytes)
+ * The CRC is CRC-CCITT (seed 0xffff, MSB first) of type, length and
+ * payload, sent MSB first; the stub computes it with the CRC engine.
+ *
+ * Reply (stub to host):
+ *	STUB_SOF, type, status, seq, data (STUB_READ and STUB_VERIFY)
+ * seq is the one of STUB_COMMIT; a window whose reply was lost is not
+ * programmed again.
+ *
+ * Data is sent in windows.  The STUB_DATA frames of a window are sent
+ * back to back into the window buffer of the stub; STUB_COMMIT programs
+ * the buffer, compares the CRC-32 of the flash with the one of the host,
+ * and is the only frame of the window that is answered.  The USART has
+ * no FIFO and the part can't receive while the IAP runs, so the host
+ * waits for the reply before the next window.
+ *
+ * STUB_DATA is compressed (LZ77):
+ *	0x00 - 0x7f	literal, (c + 1) bytes follow
+ *	0x80 - 0xff	match, (c - 0x80 + 3) bytes from the window buffer,
+ *			2 bytes of distance (1 or more, LSB first) follow
+ * A match may overlap its source, so a run of a byte is a match of
+ * distance 1.
+ */
+
+#define STUB_RAM		0x10000000
+#define STUB_LOADER		0x10000300
+#define STUB_ENTRY		(STUB_LOADER + 4)
+#define STUB_STACK		0x100003e0	/* top of 1 KB - 32 bytes */
+#define STUB_VERSION		1
+
+#define STUB_SOF		0x7e
+#define STUB_PAYLOAD_MAX	255
+
+/*
+ * Frame types and payloads (bytes)
+ *   STUB_HELLO		reply only; seq is the version
+ *   STUB_SETUP		brg (2), frgmult (1), 0 (1), buffer (4),
+ *			window (2)
+ *   STUB_ERASE		start sector (1), end sector (1)
+ *   STUB_DATA		offset in window (2), LZ data
+ *   STUB_COMMIT	address (4), bytes (2), seq (1), 0 (1),
+ *			CRC-32 (4)
+ *   STUB_VERIFY	address (4), bytes (2); data: CRC-32 (4)
+ *   STUB_READ		address (4), bytes (2); data: bytes
+ */
+#define STUB_HELLO		'H'
+#define STUB_SETUP		'S'
+#define STUB_ERASE		'E'
+#define STUB_DATA		'D'
+#define STUB_COMMIT		'C'
+#define STUB_VERIFY		'V'
+#define STUB_READ		'R'
+
+/* Status (1 - 11: IAP status code) */
+#define STUB_OK			0
+#define STUB_BAD_FRAME		0x80	/* data frame lost */
+#define STUB_BAD_DATA		0x81	/* window CRC error */
+#define STUB_VERIFY_ERROR	0x82	/* flash doesn't match the CRC */
+#define STUB_INVALID		0x83	/* unknown type or parameter */
+
+/* Match length */
+#define STUB_MATCH_MIN		3
+#define STUB_MATCH_MAX		(0x7f + STUB_MATCH_MIN)
+
+/* The stub runs on the IRC (boot ROM default). */
+#define STUB_CLOCK		12000000
@@ -0,0 +1,67 @@
+/*
+ * Linker script of the flash stub
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The body takes the SRAM below the loader, which is the part the ISP
+ * doesn't let 'W' write.  The rest of the first 1 KB is the loader and
+ * the stack (STUB_STACK); the window buffer is above it.
+ */
+
+OUTPUT_FORMAT("elf32-littlearm", "elf32-bigarm", "elf32-littlearm");
+OUTPUT_ARCH(arm);
+
+MEMORY
+{
+	BODY : ORIGIN = 0x10000000, LENGTH = 0x300
+	LOADER : ORIGIN = 0x10000300, LENGTH = 0x40
+}
+
+ENTRY(stub_loader);
+
+SECTIONS
+{
+	/* Zero-initialized data is sent as part of the image. */
+	.body :
+	{
+		_body_start = .;
+		*(.text*)
+		*(.rodata*)
+		*(.data*)
+		*(.bss*)
+		*(COMMON)
+		. = ALIGN(4);
+		_body_end = .;
+	} > BODY
+	.loader :
+	{
+		LONG(_body_end - _body_start)
+		*(.loader*)
+		. = ALIGN(4);
+	} > LOADER
+	/DISCARD/ :
+	{
+		*(.ARM.exidx*)
+		*(.comment)
+	}
+}
+
+ASSERT(stub_loader == 0x10000304 || stub_loader == 0x10000305,
+       "stub_loader must follow the size word")
@@ -0,0 +1,246 @@
+/*
+ * trace.c - ISP command timing
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A record starts when a command is sent and ends with the last byte
+ * transferred before the next command.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "command.h"
+#include "trace.h"
+
+static char *phase_name[PHASES] = {
+	"sync", "unlock", "erase", "write", "copy", "verify", "read"
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int trace_init(struct trace *trace)
+{
+	trace->t0 = now_us();
+	trace->count = 0;
+	trace->size = 256;
+	trace->rec = malloc(trace->size * sizeof(struct trace_record));
+	if (trace->rec == NULL) {
+		perror("malloc() failed");
+		return -1;
+	}
+	return 0;
+}
+
+void trace_free(struct trace *trace)
+{
+	free(trace->rec);
+	trace->rec = NULL;
+}
+
+/* Start a record. */
+void trace_command(struct port *port, char com)
+{
+	struct trace *trace = port->trace;
+	struct trace_record *p;
+
+	if (trace == NULL || trace->rec == NULL)
+		return;
+
+	if (trace->count >= trace->size) {
+		p = realloc(trace->rec,
+			    trace->size * 2 * sizeof(struct trace_record));
+		if (p == NULL)
+			return;
+		trace->rec = p;
+		trace->size *= 2;
+	}
+
+	p = &trace->rec[trace->count++];
+	p->com = com;
+	switch (com) {
+	case '?':
+	case 'A':
+	case 'B':
+		p->phase = PHASE_SYNC;
+		break;
+	case 'U':
+		p->phase = PHASE_UNLOCK;
+		break;
+	case 'W':
+		p->phase = PHASE_WRITE;
+		break;
+	case 'C':
+		p->phase = PHASE_COPY;
+		break;
+	default:
+		/* Prepare, blank check etc. belong to the current phase. */
+		p->phase = port->phase;
+		break;
+	}
+	p->start = now_us() - trace->t0;
+	p->end = p->start;
+	p->tx = 0;
+	p->rx = 0;
+	p->retries = 0;
+}
+
+void trace_retry(struct port *port)
+{
+	struct trace *trace = port->trace;
+
+	if (trace && trace->count)
+		trace->rec[trace->count - 1].retries++;
+}
+
+/* Account bytes sent or received. */
+void trace_io(struct port *port, int tx, int rx)
+{
+	struct trace *trace = port->trace;
+	struct trace_record *p;
+	long long t;
+
+	if (trace == NULL || trace->count == 0)
+		return;
+
+	p = &trace->rec[trace->count - 1];
+	p->tx += tx;
+	p->rx += rx;
+	t = now_us();
+	/* Sent data takes until it has left the line. */
+	if (tx && t < port->drain * 1000)
+		t = port->drain * 1000;
+	if (p->end < t - trace->t0)
+		p->end = t - trace->t0;
+}
+
+/* Print the time spent in each phase. */
+void trace_summary(struct port *port)
+{
+	struct trace *trace = port->trace;
+	struct trace_record *p;
+	int count[PHASES] = { 0 };
+	long long time[PHASES] = { 0 };
+	int bytes[PHASES] = { 0 };
+	long long total;
+	int i;
+
+	if (trace == NULL || trace->rec == NULL)
+		return;
+
+	total = 0;
+	for (i = 0; i < trace->count; i++) {
+		p = &trace->rec[i];
+		count[p->phase]++;
+		time[p->phase] += p->end - p->start;
+		bytes[p->phase] += p->tx + p->rx;
+		total += p->end - p->start;
+	}
+
+	message(port, "phase    commands   time(ms)      %%    bytes   "
+		"KB/s\n");
+	for (i = 0; i < PHASES; i++) {
+		if (count[i] == 0)
+			continue;
+		message(port, "%-8s %8d %10.1f %6.1f %8d %6.1f\n",
+			phase_name[i], count[i], time[i] / 1000.0,
+			total ? time[i] * 100.0 / total : 0.0, bytes[i],
+			time[i] ? bytes[i] * 1000.0 / time[i] : 0.0);
+	}
+}
+
+void trace_header(FILE *stream, bool json)
+{
+	if (json)
+		fprintf(stream, "[");
+	else
+		fprintf(stream, "device,seq,phase,command,start_us,end_us,"
+			"tx_bytes,rx_bytes,retries\n");
+}
+
+/* Write s as a JSON string. */
+static void json_string(FILE *stream, const char *s)
+{
+	fputc('"', stream);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(stream, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(stream, "\\u%04x", *s);
+		else
+			fputc(*s, stream);
+	}
+	fputc('"', stream);
+}
+
+/* Write s as a CSV field (RFC 4180). */
+static void csv_string(FILE *stream, const char *s)
+{
+	fputc('"', stream);
+	for (; *s; s++) {
+		if (*s == '"')
+			fputc('"', stream);
+		fputc(*s, stream);
+	}
+	fputc('"', stream);
+}
+
+/* Write the records as CSV or JSON.  n: records written so far */
+int trace_write(FILE *stream, bool json, char *device, struct trace *trace,
+		int n)
+{
+	struct trace_record *p;
+	int i;
+
+	for (i = 0; i < trace->count; i++, n++) {
+		p = &trace->rec[i];
+		if (json) {
+			fprintf(stream, "%s\n {\"device\": ", n ? "," : "");
+			json_string(stream, device);
+			fprintf(stream, ", \"seq\": %d, \"phase\": \"%s\", "
+				"\"command\": \"%c\", \"start_us\": %lld, "
+				"\"end_us\": %lld, \"tx_bytes\": %d, "
+				"\"rx_bytes\": %d, \"retries\": %d}",
+				i, phase_name[p->phase], p->com, p->start,
+				p->end, p->tx, p->rx, p->retries);
+		} else {
+			csv_string(stream, device);
+			fprintf(stream, ",%d,%s,%c,%lld,%lld,%d,%d,%d\n",
+				i, phase_name[p->phase], p->com, p->start,
+				p->end, p->tx, p->rx, p->retries);
+		}
+	}
+	return n;
+}
+
+void trace_footer(FILE *stream, bool json)
+{
+	if (json)
+		fprintf(stream, "\n]\n");
+}
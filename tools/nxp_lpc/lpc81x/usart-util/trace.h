@@ -0,0 +1,61 @@
+/*
+ * trace.h
+ *
+ * Copyright 2014 Toshiaki Yoshida <yoshida@mpc.net>
+ *
+ * This file is part of usart-util.
+ *
+ * usart-util is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * usart-util is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Phases */
+enum {
+	PHASE_SYNC,
+	PHASE_UNLOCK,
+	PHASE_ERASE,
+	PHASE_WRITE,
+	PHASE_COPY,
+	PHASE_VERIFY,
+	PHASE_READ,
+	PHASES
+};
+
+/* One ISP command */
+struct trace_record {
+	char com;		/* command ('?': synchronization) */
+	int phase;
+	long long start;	/* us from trace_init() */
+	long long end;
+	int tx;			/* bytes sent */
+	int rx;			/* bytes received */
+	int retries;
+};
+
+struct trace {
+	long long t0;
+	struct trace_record *rec;
+	int count;
+	int size;
+};
+
+int trace_init(struct trace *trace);
+void trace_free(struct trace *trace);
+void trace_command(struct port *port, char com);
+void trace_retry(struct port *port);
+void trace_io(struct port *port, int tx, int rx);
+void trace_summary(struct port *port);
+void trace_header(FILE *stream, bool json);
+int trace_write(FILE *stream, bool json, char *device, struct trace *trace,
+		int n);
+void trace_footer(FILE *stream, bool json);
@@ -24,12 +24,155 @@
 #include <stdbool.h>
 
 #include "command.h"
+#include "image.h"
 #include "transfer.h"
+#include "crc32.h"
+#include "trace.h"
 
 extern bool debug;
-extern int sram_size;
+extern bool crc_verify;
+extern bool incremental;
 
-int upload(int fd, FILE *stream, int bytes)
+/* Copy size ('C': 64, 128, 256, 512 or 1024) that holds bytes */
+static int copy_size(int bytes)
+{
+	int size;
+
+	for (size = PAGE_SIZE; size < bytes && size < SECTOR_SIZE; size <<= 1)
+		;
+	return size;
+}
+
+/*
+ * Staging area for 'W', from RESERVE_SIZE to the ISP stack (256 bytes
+ * below the 32 bytes of the IAP at the top of SRAM): whole sectors if
+ * there is room for one (2 KB on the LPC812), else the largest copy size
+ * that fits (512 bytes on the LPC811).
+ *
+ * On the LPC810 all the SRAM that 'W' accepts is in the ISP stack.  It
+ * gets the smallest copy size, 64 bytes at the bottom, which the stack
+ * reaches only when it is more than 160 bytes deep.
+ */
+static int stage_size(struct port *port)
+{
+	int avail;
+	int size;
+
+	avail = port->sram_size - RESERVE_SIZE - IAP_RAM_SIZE - ISP_STACK_SIZE;
+	if (avail >= SECTOR_SIZE)
+		return avail / SECTOR_SIZE * SECTOR_SIZE;
+	for (size = SECTOR_SIZE; size > PAGE_SIZE && size > avail; size >>= 1)
+		;
+	return size;
+}
+
+/*
+ * Write n bytes (a multiple of the copy sizes) at flashaddr (sector
+ * aligned).  Each 'W' fills the staging area; each sector of it is
+ * copied with a 'P' and a 'C', as a 'C' protects the sectors again.
+ *
+ * Each command waits for its return code before the next one is sent.
+ * The LPC81x USART has no receive FIFO and the boot ROM doesn't read the
+ * line while it runs a command, so a 'W' sent during a 'C' is overrun
+ * and lost.  The ROM has no command to load data into SRAM in the
+ * background either, so there is nothing to overlap the copy with.
+ */
+static int write_block(struct port *port, uint32_t flashaddr, uint8_t *buf,
+		       int n, uint32_t ramaddr, int stage)
+{
+	int sector;
+	int i;
+	int j;
+	int m;
+	int c;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < stage ? n - i : stage;
+		if (write_to_ram(port, ramaddr, m, &buf[i]))
+			return -1;
+
+		for (j = 0; j < m; j += c) {
+			c = m - j < SECTOR_SIZE ? m - j : SECTOR_SIZE;
+			sector = (flashaddr + i + j) / SECTOR_SIZE;
+			if (prepare_sectors(port, sector, sector))
+				return -1;
+
+			if (copy_ram_to_flash(port, flashaddr + i + j,
+					      ramaddr + j, c))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Verify data
+ *
+ * With crc_verify, the device computes the CRC of the written data ('S')
+ * and the data is read back only if it doesn't match the host's CRC.
+ */
+static int verify_block(struct port *port, uint32_t flashaddr, uint8_t *buf,
+			int n)
+{
+	uint32_t crc;
+	int i;
+	int j;
+	int m;
+	uint8_t flash[SECTOR_SIZE];
+
+	if (crc_verify) {
+		if (read_crc_checksum(port, flashaddr, n, &crc))
+			return -1;
+		if (crc == crc32(buf, n))
+			return 0;
+		if (debug)
+			message(port, "CRC mismatch (0x%08x 0x%08x)\n",
+				crc, crc32(buf, n));
+	}
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < SECTOR_SIZE ? n - i : SECTOR_SIZE;
+		if (read_memory(port, flashaddr + i, m, flash))
+			return -1;
+
+		for (j = 0; j < m; j++) {
+			if (buf[i + j] != flash[j]) {
+				error_message(port, "Verify failed\n");
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Print the Code Read Protection setting. */
+void print_crp(struct port *port, uint32_t w)
+{
+	if (debug)
+		message(port, "CRP = 0x%08x\n", w);
+
+	switch (w) {
+	case 0x12345678:
+		message(port, "CRP: CRP1\n");
+		break;
+	case 0x87654321:
+		message(port, "CRP: CRP2\n");
+		break;
+	case 0x43218765:
+		message(port, "CRP: CRP3\n");
+		break;
+	case 0x4e697370:
+		message(port, "CRP: NO_ISP\n");
+		break;
+	default:
+		message(port, "CRP: NONE\n");
+		break;
+	}
+}
+
+int upload(struct port *port, FILE *stream, int bytes)
 {
 	uint32_t a;
 	int i;
@@ -37,185 +180,163 @@ int upload(int fd, FILE *stream, int bytes)
 	int r;
 	uint8_t buf[SECTOR_SIZE];
 
+	port->phase = PHASE_READ;
 	a = FLASH_ADDRESS;
 	i = 0;
 	while (i < bytes) {
 		n = (bytes - i) > sizeof(buf) ? sizeof(buf) : bytes - i;
 
-		r = read_memory(fd, a, n, buf);
+		r = read_memory(port, a, n, buf);
 		if (r)
 			return -1;
 		r = fwrite(buf, 1, n, stream);
 		if (r != n) {
-			fprintf(stderr, "fwrite() failed\n");
+			error_message(port, "fwrite() failed\n");
 			return -1;
 		}
 
 		if (debug)
-			printf("%08x\n", a);
+			message(port, "%08x\n", a);
 
 		a += n;
 		i += n;
 	}
 
-	printf("read %d bytes\n", bytes);
+	message(port, "read %d bytes\n", bytes);
 	return bytes;
 }
 
-int download(int fd, FILE *stream)
+/*
+ * Erase the sectors start to end: one 'I' for all of them, then one 'P'
+ * and 'E' for all of them unless they are blank.
+ */
+static int erase_range(struct port *port, int start, int end)
+{
+	int r;
+
+	if (debug)
+		message(port, "- Blank check -\n");
+	port->phase = PHASE_ERASE;
+	r = blank_check_sectors(port, start, end);
+	if (r == 0)
+		return 0;
+	if (r != RESULT_SECTOR_NOT_BLANK)
+		return -1;
+
+	if (debug)
+		message(port, "- Erase -\n");
+	if (prepare_sectors(port, start, end))
+		return -1;
+	if (erase_sectors(port, start, end))
+		return -1;
+
+	/* Erase check */
+	if (blank_check_sectors(port, start, end))
+		return -1;
+	return 0;
+}
+
+int download(struct port *port, struct image *image)
 {
 	uint32_t ramaddr;
-	int ramsize;
+	int stage;
 	int sector;
-	int bytes;
+	int end;
+	int sectors;
+	int skipped;
+	int written;
+	bool dirty[IMAGE_SECTORS + 1];
 	uint32_t flashaddr;
-	int r;
-	uint8_t buf[SECTOR_SIZE];
+	uint8_t *buf;
 	int n;
-	int i;
 	uint32_t w;
-	int m;
 	uint8_t flash[SECTOR_SIZE];
 
 	ramaddr = SRAM_ADDRESS + RESERVE_SIZE;
-	if (sram_size <= SECTOR_SIZE + RESERVE_SIZE)
-		ramsize = sram_size - RESERVE_SIZE;
-	else
-		ramsize = SECTOR_SIZE;
+	stage = stage_size(port);
 
-	if (unlock(fd))
+	if (unlock(port))
 		return -1;
 
-	sector = 0;
-	bytes = 0;
-	flashaddr = FLASH_ADDRESS;
-	while (!feof(stream)) {
-		r = fread(buf, 1, sizeof(buf), stream);
-		n = (r + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-		if (r < sizeof(buf)) {
-			if (ferror(stream)) {
-				fprintf(stderr, "File read error\n");
-				return -1;
-			}
-
-			if (r == 0)
-				break;
+	if (image->end[0])
+		message(port, "Checksum = 0x%08x\n", image->checksum);
 
-			for (i = r; i < sizeof(buf); i++)
-				buf[i] = 0xff;
-		}
-		bytes += r;
-
-		/* Set checksum */
-		if (sector == 0) {
-			w = 0;
-			for (i = 0; i < 7; i++)
-				w += buf[i * 4 + 3] << 24 |
-					buf[i * 4 + 2] << 16 |
-					buf[i * 4 + 1] << 8 |
-					buf[i * 4];
-			w = -w;
-			buf[7 * 4] = w & 0xff;
-			buf[7 * 4 + 1] = w >> 8 & 0xff;
-			buf[7 * 4 + 2] = w >> 16 & 0xff;
-			buf[7 * 4 + 3] = w >> 24;
-
-			printf("Checksum = 0x%08x\n", w);
-		}
+	/* Sectors to write: the ones that contain data */
+	sectors = 0;
+	skipped = 0;
+	written = 0;
+	for (sector = 0; sector < IMAGE_SECTORS; sector++) {
+		dirty[sector] = false;
+		if (image->end[sector] == 0)
+			continue;
+		sectors++;
 
-		if (debug)
-			printf("- Blank check -\n");
-		/* Blank check */
-		r = blank_check_sectors(fd, sector, sector);
-		if (r == RESULT_SECTOR_NOT_BLANK) {
+		/* Skip unchanged sector */
+		if (incremental) {
+			port->phase = PHASE_VERIFY;
 			if (debug)
-				printf("- Erase -\n");
-			/* Erase */
-			if (prepare_sectors(fd, sector, sector))
+				message(port, "- Compare CRC -\n");
+			buf = &image->data[sector * SECTOR_SIZE];
+			flashaddr = FLASH_ADDRESS + sector * SECTOR_SIZE;
+			if (read_crc_checksum(port, flashaddr, SECTOR_SIZE, &w))
 				return -1;
+			if (w == crc32(buf, SECTOR_SIZE)) {
+				if (debug)
+					message(port, "Sector %d unchanged\n",
+						sector);
+				skipped++;
+				continue;
+			}
+		}
+		dirty[sector] = true;
+		written += image->end[sector];
+	}
+	dirty[IMAGE_SECTORS] = false;
 
-			if (erase_sectors(fd, sector, sector))
-				return -1;
+	/* Each run of sectors to write at a time */
+	for (sector = 0; sector < IMAGE_SECTORS; sector = end + 1) {
+		end = sector;
+		if (!dirty[sector])
+			continue;
+		while (dirty[end + 1])
+			end++;
 
-			/* Erase check */
-			if (blank_check_sectors(fd, sector, sector))
-				return -1;
-		} else if (r) {
+		if (erase_range(port, sector, end))
 			return -1;
-		}
-
-		if (debug)
-			printf("- Write data -\n");
-		/* Write data */
-		for (i = 0; i < n; i += m) {
-			if (n - i <= 64)
-				m = 64; /* PAGE_SIZE */
-			else if (n - i <= 128)
-				m = 128;
-			else if (ramsize <= 256)
-				m = 128;
-			else if (n - i <= 256)
-				m = 256;
-			else if (n - i <= 512)
-				m = 512;
-			else
-				m = 1024; /* SECTOR_SIZE */
-			if (write_to_ram(fd, ramaddr, m, &buf[i]))
-				return -1;
 
-			if (prepare_sectors(fd, sector, sector))
-				return -1;
+		/* The unused bytes of the image are 0xff. */
+		buf = &image->data[sector * SECTOR_SIZE];
+		n = (end - sector) * SECTOR_SIZE + copy_size(image->end[end]);
+		flashaddr = FLASH_ADDRESS + sector * SECTOR_SIZE;
 
-			if (copy_ram_to_flash(fd, flashaddr + i, ramaddr, m))
-				return -1;
-		}
+		if (debug)
+			message(port, "- Write data -\n");
+		/* Write data ('P'; 'W' and 'C' set their own phase) */
+		port->phase = PHASE_COPY;
+		if (write_block(port, flashaddr, buf, n, ramaddr, stage))
+			return -1;
 
 		if (debug)
-			printf("- Verify data -\n");
+			message(port, "- Verify data -\n");
+		port->phase = PHASE_VERIFY;
 		/* Verify data */
-		if (read_memory(fd, flashaddr, n, flash))
+		if (verify_block(port, flashaddr, buf, n))
 			return -1;
-
-		for (i = 0; i < n; i++) {
-			if (buf[i] != flash[i]) {
-				fprintf(stderr, "Verify failed\n");
-				return -1;
-			}
-		}
-
-		sector++;
-		flashaddr += n;
 	}
 
 	/* Check Code Read Protection */
-	if (read_memory(fd, CRP, 4, flash))
+	if (read_memory(port, CRP, 4, flash))
 		return -1;
 
 	w = flash[3] << 24 |
 		flash[2] << 16 |
 		flash[1] << 8 |
 		flash[0];
-	if (debug)
-		printf("CRP = 0x%08x\n", w);
+	print_crp(port, w);
 
-	switch (w) {
-	case 0x12345678:
-		printf("CRP: CRP1\n");
-		break;
-	case 0x87654321:
-		printf("CRP: CRP2\n");
-		break;
-	case 0x43218765:
-		printf("CRP: CRP3\n");
-		break;
-	case 0x4e697370:
-		printf("CRP: NO_ISP\n");
-		break;
-	default:
-		printf("CRP: NONE\n");
-		break;
-	}
-
-	printf("wrote %d bytes\n", bytes);
-	return bytes;
+	if (incremental)
+		message(port, "%d of %d sectors unchanged\n", skipped,
+			sectors);
+	message(port, "wrote %d bytes\n", written);
+	return written;
 }
@@ -22,7 +22,10 @@
 #define FLASH_ADDRESS	0x00000000
 #define SRAM_ADDRESS	0x10000000
 #define RESERVE_SIZE	0x00000300
+#define IAP_RAM_SIZE	0x00000020	/* top of SRAM */
+#define ISP_STACK_SIZE	0x00000100	/* below the IAP area */
 #define CRP		0x000002fc
 
-int upload(int fd, FILE *stream, int bytes);
-int download(int fd, FILE *stream);
+int upload(struct port *port, FILE *stream, int bytes);
+int download(struct port *port, struct image *image);
+void print_crp(struct port *port, uint32_t w);